@@ -0,0 +1,58 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* adapt.c
+ * Adjustment of compression levels to reach a target speed.
+ */
+
+#include <config.h>
+#include "algorithm.h"
+
+// Amount of input after which the speed is measured and the level adjusted.
+#define ADAPT_BLOCK_SIZE (1024 * 1024)
+
+void initLevelControl(struct levelcontrol* control, int level, int minLevel,
+        int maxLevel) {
+    control->level = level;
+    control->minLevel = minLevel;
+    control->maxLevel = maxLevel;
+    control->blockStart = 0;
+    clock_gettime(CLOCK_MONOTONIC, &control->startTime);
+}
+
+int adjustLevel(struct levelcontrol* control, uint64_t position) {
+    if (!targetSpeed || position - control->blockStart < ADAPT_BLOCK_SIZE) {
+        return control->level;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - control->startTime.tv_sec) +
+            (now.tv_nsec - control->startTime.tv_nsec) / 1e9;
+    double speed = seconds > 0 ? (position - control->blockStart) / seconds :
+            1e12;
+    control->blockStart = position;
+    control->startTime = now;
+
+    // Only raise the level when we are well above the target so that the
+    // level does not switch back and forth for every block.
+    if (speed < targetSpeed && control->level > control->minLevel) {
+        control->level--;
+    } else if (speed > 1.5 * targetSpeed &&
+            control->level < control->maxLevel) {
+        control->level++;
+    }
+    return control->level;
+}
@@ -1,4 +1,4 @@
-/* Copyright (c) 2020, 2022 Dennis Wölfing
+/* Copyright (c) 2020, 2022, 2026 Dennis Wölfing
  *
  * Permission to use, copy, modify, and/or distribute this software for any
  * purpose with or without fee is hereby granted, provided that the above
@@ -20,11 +20,28 @@
 #ifndef ALGORITHM_H
 #define ALGORITHM_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 #include <sys/types.h>
 
+// Static probes for tracing tools like bpftrace and perf. They are only
+// compiled in when <sys/sdt.h> is available and each costs a single nop while
+// no tool is attached.
+#if HAVE_SYS_SDT_H
+#  include <sys/sdt.h>
+#  define PROBE1(name, a) DTRACE_PROBE1(dxcompress, name, a)
+#  define PROBE2(name, a, b) DTRACE_PROBE2(dxcompress, name, a, b)
+#  define PROBE4(name, a, b, c, d) DTRACE_PROBE4(dxcompress, name, a, b, c, d)
+#else
+#  define PROBE1(name, a) ((void) (a))
+#  define PROBE2(name, a, b) ((void) (a), (void) (b))
+#  define PROBE4(name, a, b, c, d) \
+        ((void) (a), (void) (b), (void) (c), (void) (d))
+#endif
+
 enum {
     RESULT_OK,
     RESULT_READ_ERROR,
@@ -34,6 +51,7 @@ enum {
     RESULT_UNIMPLEMENTED_FORMAT,
     RESULT_OUT_OF_MEMORY,
     RESULT_OPEN_FAILURE,
+    RESULT_ABORTED,
     RESULT_UNKNOWN_ERROR
 };
 
@@ -43,9 +61,18 @@ struct fileinfo {
     off_t compressedSize;
     off_t uncompressedSize;
     uint32_t crc;
+    size_t peakMemory;
+    // Number of threads that the engine used. Engines that only use the
+    // calling thread leave this at 0, which counts as one thread.
+    int threads;
     struct outputinfo* oinfo;
 };
 
+struct memaccount {
+    atomic_size_t current;
+    atomic_size_t peak;
+};
+
 struct algorithm {
     // Names of this algorithm separated by commas.
     const char* names;
@@ -55,19 +82,235 @@ struct algorithm {
     int minLevel;
     int defaultLevel;
     int maxLevel;
+    // Highest level that can be selected with --ultra, or 0 if none.
+    int ultraLevel;
     int (*compress)(int input, int output, int level, struct fileinfo* info);
     int (*decompress)(int input, int output, struct fileinfo* info,
             const unsigned char* buffer, size_t bufferSize);
     bool (*probe)(const unsigned char* buffer, size_t bufferSize);
+    // Free any codec state that the calling thread keeps for reuse.
+    void (*freeCache)(void);
+};
+
+struct calibration {
+    const struct algorithm* algorithm;
+    int level;
+    // Compression speed in bytes per second, or 0 if not supported.
+    double speed;
+    // Compressed size divided by uncompressed size.
+    double ratio;
+};
+
+// State for adjusting the level between blocks to reach --target-speed.
+struct levelcontrol {
+    int level;
+    int minLevel;
+    int maxLevel;
+    uint64_t blockStart;
+    struct timespec startTime;
+};
+
+// An encoder that is run by compressFanout.
+struct encoder {
+    const struct algorithm* algorithm;
+    int level;
+    int output;
+    // If not NULL, this is lowered to the compressed size when the encoder
+    // finishes successfully.
+    _Atomic off_t* smallest;
+    struct fileinfo info;
+    int result;
+    int input;
+};
+
+// State for flushing the output when using --flush-bytes or --flush-interval.
+struct flushcontrol {
+    // Amount of input that was read since the last flush.
+    uint64_t pending;
+    struct timespec pendingSince;
+};
+
+// Measurements of a file for --stats. Times are in seconds.
+struct stats {
+    double wallTime;
+    double cpuTime;
+    double readWait;
+    double writeWait;
+    double codecTime;
+    uint64_t readCalls;
+    uint64_t readBytes;
+    uint64_t writeCalls;
+    uint64_t writeBytes;
+    off_t uncompressedSize;
+    // Peak resident set size in KiB.
+    long peakRss;
+    unsigned int files;
 };
 
+// A record of --metrics-json about one processed file.
+struct metrics {
+    const char* path;
+    const char* mode;
+    // The algorithm is NULL if the format is not known. The level is -1 when
+    // decompressing.
+    const struct algorithm* algorithm;
+    int level;
+    int threads;
+    off_t inputSize;
+    off_t outputSize;
+    int result;
+    // Whether the file was left unchanged because it did not compress well.
+    bool skipped;
+    const struct stats* stats;
+};
+
+extern const struct algorithm algoBzip2;
 extern const struct algorithm algoDeflate;
+extern const struct algorithm algoLz4;
 extern const struct algorithm algoLzw;
 extern const struct algorithm algoXz;
+extern const struct algorithm algoZstd;
 
+extern uint64_t checkpointInterval;
+extern uint64_t flushBytes;
+extern unsigned long flushInterval;
+extern int longWindowLog;
 extern int maxThreads;
+extern uint64_t memoryLimit;
+extern struct memaccount processMemory;
+extern uint64_t targetSpeed;
+extern bool tracing;
+
+// Records that size bytes of input were read.
+void addFlushInput(struct flushcontrol* control, size_t size);
+// Returns true if the engine should flush its output before it reads more
+// input. This waits for input until the pending data is due to be flushed.
+bool shouldFlush(int input, struct flushcontrol* control);
+
+// Returns the level to use for the data after position bytes of input. The
+// level only changes when a target speed was given.
+int adjustLevel(struct levelcontrol* control, uint64_t position);
+void initLevelControl(struct levelcontrol* control, int level, int minLevel,
+        int maxLevel);
+
+// Returns the path of the named file in the cache directory, or NULL if there
+// is none. The directory is created when create is true.
+char* getCachePath(const char* name, bool create);
+// Returns the configuration that best meets the given targets for data that
+// compresses to sampleRatio of its size with the first calibrated algorithm.
+const struct calibration* chooseConfiguration(double sampleRatio,
+        uint64_t targetSpeed, double targetRatio);
+// Returns the calibration profile of this machine, measuring it if needed.
+const struct calibration* getCalibration(size_t* count, bool verbose);
+
+// Measures compression and decompression of the input with each of the
+// algorithms at all levels from firstLevel to lastLevel and prints the results.
+// A firstLevel of -1, -2 or -3 selects the default, minimum or maximum level.
+int benchmarkFile(int input, const char* name,
+        const struct algorithm* const* algorithms, int firstLevel,
+        int lastLevel, bool csv);
+
+// Compresses the input in segments of checkpointInterval bytes and records
+// after each segment in the checkpoint file where compression can be resumed.
+// The checkpoint file is removed when compression has finished. *checkpointed
+// is set to whether a checkpoint for the input exists afterwards.
+int compressCheckpointed(int input, int output,
+        const struct algorithm* algorithm, int level, struct fileinfo* info,
+        const char* path, bool* checkpointed);
+// Opens the output for resuming compression at the checkpoint and seeks the
+// input to the matching offset. Returns -1 if there is no valid checkpoint.
+int resumeCheckpoint(const char* path, int input, int dirFd,
+        const char* outputName);
+
+// Compresses the input with all encoders in parallel while reading it once.
+// Returns RESULT_READ_ERROR if the input could not be read and RESULT_OK
+// otherwise. The result of each encoder is stored in the encoder.
+int compressFanout(int input, struct encoder* encoders, size_t count);
+
+// Returns the offset of the input up to which it was already appended to the
+// output by an earlier --append, or 0.
+off_t getAppendOffset(int input, int output);
+// Records that the input up to offset has been appended to the output.
+void saveAppendOffset(int input, int output, off_t offset);
+
+// Returns true if the file is already compressed or consists of random data.
+bool isIncompressible(int fd, off_t size);
+
+// Like allocateMemory, but uses huge pages even for memory that is smaller than
+// a huge page. This is meant for tables that are accessed randomly.
+void* allocateLargeMemory(struct memaccount* account, size_t size);
+void* allocateMemory(struct memaccount* account, size_t size);
+void freeMemory(void* ptr);
+uint64_t getMemoryBudget(void);
+struct memaccount* getThreadAccount(void);
+void resetMemoryPeak(struct memaccount* account);
+
+// Returns the number of threads to use for parallel compression when each
+// thread needs the given amount of memory.
+size_t getThreadCount(uint64_t memoryPerThread);
+// Calls function for each of the count items in parallel.
+void runParallel(void* (*function)(void*), void* items, size_t itemSize,
+        size_t count);
+
+// Functions for --progress. Progress is shown for one file at a time.
+// Prints the final line. The sizes in info are those of the whole file.
+void finishProgress(const struct fileinfo* info);
+// Sets the sizes that were processed before the engine started, like the
+// earlier segments of a checkpointed file.
+void setProgressOffset(off_t uncompressedSize, off_t compressedSize);
+// Starts showing progress for the file. The total size is known when input is
+// a regular file.
+void startProgress(const char* path, int input, bool compress);
+// Prints the progress when the last update is long enough ago.
+void updateProgress(const struct fileinfo* info);
+
+// Functions for --stats. Only I/O on file descriptors that were passed to
+// trackStats after the last call to startStats is measured.
+void addStats(struct stats* total, const struct stats* stats);
+void printStats(const char* name, const struct stats* stats);
+// Like read(2) and write(2), but measured for --stats.
+ssize_t readInput(int fd, void* buffer, size_t size);
+void startStats(void);
+void stopStats(struct stats* stats);
+void trackStats(int fd);
+ssize_t writeOutput(int fd, const void* buffer, size_t size);
+
+// Writes the string as a JSON string with quotes and escapes.
+void writeJsonString(FILE* file, const char* string);
+// Writes the record as a line of JSON to the file descriptor.
+void writeMetrics(int fd, const struct metrics* metrics);
+
+// Functions for --trace. Spans are buffered per thread and written to the
+// trace file when the buffer is full, when the thread exits and by writeTrace.
+// Starts a span for a file and returns its start time.
+uint64_t beginTraceFile(void);
+void endTraceFile(const char* path, uint64_t start);
+bool startTrace(const char* path);
+// Records a span for a block that was processed since start.
+void traceBlock(uint64_t start);
+// Records a read or write that started at start and the codec work of the
+// thread since its previous read or write.
+void traceIo(const char* name, uint64_t start, ssize_t result);
+// Returns the current time for traceBlock, or 0 when not tracing.
+uint64_t traceTime(void);
+bool writeTrace(void);
+
+// Decompresses the input with one algorithm and compresses the result with
+// another one. The first bufferSize bytes of input are in buffer.
+int transcode(int input, int output, const struct algorithm* from,
+        const unsigned char* buffer, size_t bufferSize,
+        const struct algorithm* to, int level, struct fileinfo* info);
 
+void freeCaches(void);
 int openOutputFile(const char* outputName, struct outputinfo* oinfo);
+// Called by the decompressors once the name and modificationTime fields of info
+// are known and before any output is written.
+void reportHeader(struct fileinfo* info);
+// Called by the engines after updating the compressedSize and uncompressedSize
+// fields of info. Returns false if the engine should abort with RESULT_ABORTED.
+bool reportProgress(struct fileinfo* info);
+// Prints a message prefixed with the program name to stderr.
+void printWarning(const char* format, ...);
 ssize_t writeAll(int fd, const void* buffer, size_t size);
 
 #endif
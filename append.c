@@ -0,0 +1,85 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* append.c
+ * State for continuing --append at the previous input offset.
+ */
+
+#include <config.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "algorithm.h"
+
+// The state is kept in the cache directory and is named after the device and
+// inode of the output so that no additional files are created next to it.
+static char* getStatePath(int output, bool create) {
+    struct stat st;
+    if (fstat(output, &st) < 0) return NULL;
+    char name[64];
+    snprintf(name, sizeof(name), "append-%jx-%jx", (uintmax_t) st.st_dev,
+            (uintmax_t) st.st_ino);
+    return getCachePath(name, create);
+}
+
+off_t getAppendOffset(int input, int output) {
+    char* path = getStatePath(output, false);
+    if (!path) return 0;
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        free(path);
+        return 0;
+    }
+
+    uintmax_t device, inode, offset, outputSize;
+    struct stat inputStat;
+    struct stat outputStat;
+    bool valid = fscanf(file, "%jx %jx %ju %ju", &device, &inode, &offset,
+            &outputSize) == 4 && fstat(input, &inputStat) == 0 &&
+            fstat(output, &outputStat) == 0;
+    fclose(file);
+
+    // The state is outdated if the input was replaced or truncated, e.g. by
+    // log rotation, or if something else has modified the output.
+    if (!valid || device != (uintmax_t) inputStat.st_dev ||
+            inode != (uintmax_t) inputStat.st_ino ||
+            offset > (uintmax_t) inputStat.st_size ||
+            outputSize != (uintmax_t) outputStat.st_size) {
+        unlink(path);
+        offset = 0;
+    }
+    free(path);
+    return offset;
+}
+
+void saveAppendOffset(int input, int output, off_t offset) {
+    struct stat inputStat;
+    struct stat outputStat;
+    if (fstat(input, &inputStat) < 0 || fstat(output, &outputStat) < 0) {
+        return;
+    }
+    char* path = getStatePath(output, true);
+    if (!path) return;
+    FILE* file = fopen(path, "w");
+    free(path);
+    if (!file) return;
+
+    fprintf(file, "%jx %jx %jd %jd\n", (uintmax_t) inputStat.st_dev,
+            (uintmax_t) inputStat.st_ino, (intmax_t) offset,
+            (intmax_t) outputStat.st_size);
+    fclose(file);
+}
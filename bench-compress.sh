@@ -0,0 +1,169 @@
+#! /bin/sh
+# Copyright (c) 2026 Dennis Wölfing
+#
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+# Measures all modes of compress on a generated corpus, writes the results to
+# bench/results.json and compares them to a baseline.
+
+: ${COMPRESS=compress}
+: ${BENCH_TOOL=bench-tool}
+# Size of each file in the corpus in bytes.
+: ${BENCH_SIZE=8388608}
+: ${BENCH_ALGORITHMS="lzw gzip xz lz4 bzip2 zstd"}
+: ${BENCH_THREADS="1 2 4"}
+# Each measurement is repeated and the fastest run is used.
+: ${BENCH_RUNS=3}
+# Results that are more than this many percent slower or larger than the
+# baseline are reported as regressions. An empty baseline disables this.
+: ${BENCH_BASELINE="$PWD/bench-baseline.json"}
+: ${BENCH_TOLERANCE=10}
+
+benchdir="$PWD/bench"
+rm -rf "$benchdir"
+mkdir -p "$benchdir"
+cd "$benchdir"
+results="$benchdir/results.json"
+
+exec < /dev/null
+
+"$BENCH_TOOL" corpus corpus "$BENCH_SIZE" || exit 1
+files="logs.txt data.json binary.bin random.bin zeros.bin sparse.bin"
+
+# Runs the command BENCH_RUNS times and prints the fastest time followed by
+# the maximum resident set size in KiB.
+measure() {
+    "$BENCH_TOOL" measure "$BENCH_RUNS" "$@"
+}
+
+first=true
+# Appends a result. The arguments are the mode, algorithm, threads, file name,
+# uncompressed size, compressed size and the output of measure.
+record() {
+    if $first; then
+        printf '[\n' > "$results"
+        first=false
+    else
+        printf ',\n' >> "$results"
+    fi
+    awk -v mode="$1" -v algo="$2" -v threads="$3" -v file="$4" \
+        -v size="$5" -v csize="$6" -v seconds="$7" -v rss="$8" 'BEGIN {
+        speed = seconds > 0 ? size / seconds / 1e6 : 0
+        printf "{\"mode\": \"%s\", \"algorithm\": \"%s\", \"threads\": %d, " \
+            "\"file\": \"%s\", \"size\": %d, \"compressed_size\": %d, " \
+            "\"seconds\": %.6f, \"mb_s\": %.2f, \"max_rss_kb\": %d}",
+            mode, algo, threads, file, size, csize, seconds, speed, rss
+    }' >> "$results"
+    printf '%-20s %-5s %2s %-10s %10s %9.3fs\n' "$1" "$2" "$3" "$4" "$6" "$7"
+}
+
+fail=false
+for algo in $BENCH_ALGORITHMS; do
+    if ! echo | command $COMPRESS -m $algo -c > /dev/null 2>&1; then
+        echo "Skipping $algo because it is not supported."
+        continue
+    fi
+    case $algo in
+    lzw) extension=Z ;;
+    gzip) extension=gz ;;
+    bzip2) extension=bz2 ;;
+    zstd) extension=zst ;;
+    *) extension=$algo ;;
+    esac
+
+    for threads in $BENCH_THREADS; do
+        for file in $files; do
+            size=$(wc -c < corpus/$file)
+            out=$file.$extension
+            result=$(measure sh -c 'exec "$@" > "$0"' $out \
+                $COMPRESS -c -m $algo -T $threads corpus/$file) || fail=true
+            csize=$(wc -c < $out)
+            record compress $algo $threads $file $size $csize $result
+
+            for mode in decompress test list; do
+                case $mode in
+                decompress) option=-dc ;;
+                test) option=-t ;;
+                list) option=-l ;;
+                esac
+                result=$(measure sh -c 'exec "$@" > /dev/null' sh \
+                    $COMPRESS $option -T $threads $out) || fail=true
+                record $mode $algo $threads $file $size $csize $result
+            done
+            rm -f $out
+        done
+
+        # Recursive compression and decompression of a tree of small files.
+        size=$(find corpus/tree -type f -exec cat {} + | wc -c)
+        result=$(measure sh -c 'exec "$@" > tree.out' sh \
+            $COMPRESS -rcf -m $algo -T $threads corpus/tree) || fail=true
+        csize=$(wc -c < tree.out)
+        record recursive $algo $threads tree $size $csize $result
+
+        rm -rf tree tree.out
+        cp -R corpus/tree tree
+        command $COMPRESS -rf -m $algo tree || fail=true
+        result=$(measure sh -c 'exec "$@" > /dev/null' sh \
+            $COMPRESS -drc -T $threads tree) || fail=true
+        record recursive-decompress $algo $threads tree $size $csize $result
+        rm -rf tree
+    done
+done
+
+test -e "$results" && printf '\n]\n' >> "$results"
+if $fail; then
+    echo "Some commands failed."
+    exit 1
+fi
+
+if test -z "$BENCH_BASELINE" || ! test -e "$BENCH_BASELINE"; then
+    echo "Results written to $results."
+    exit 0
+fi
+
+# Compare to the baseline. Each result is on a line of its own.
+awk -v tolerance="$BENCH_TOLERANCE" '
+function field(line, name,    value) {
+    if (!match(line, "\"" name "\": (\"[^\"]*\"|[0-9.]+)")) return ""
+    value = substr(line, RSTART + length(name) + 4, RLENGTH - length(name) - 4)
+    gsub(/"/, "", value)
+    return value
+}
+/"mode"/ {
+    key = field($0, "mode") " " field($0, "algorithm") " " \
+        field($0, "threads") " " field($0, "file")
+    if (FILENAME == ARGV[1]) {
+        speed[key] = field($0, "mb_s") + 0
+        csize[key] = field($0, "compressed_size") + 0
+        next
+    }
+    if (!(key in speed)) next
+    limit = 1 + tolerance / 100
+    if (field($0, "mb_s") * limit < speed[key]) {
+        printf "Regression: %s is at %s MB/s instead of %s MB/s\n", key,
+            field($0, "mb_s"), speed[key]
+        regressions++
+    }
+    if (field($0, "compressed_size") + 0 > csize[key] * limit) {
+        printf "Regression: %s is %s bytes instead of %s bytes\n", key,
+            field($0, "compressed_size"), csize[key]
+        regressions++
+    }
+}
+END {
+    if (regressions) exit 1
+}' "$BENCH_BASELINE" "$results" || {
+    echo "Performance regressions found."
+    exit 1
+}
+echo "No performance regressions found."
@@ -0,0 +1,117 @@
+#! /bin/sh
+# Copyright (c) 2026 Dennis Wölfing
+#
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+# Measures how the speed and memory usage of the parallel compressors scale
+# with the number of threads and writes the results to bench-threads/.
+
+: ${COMPRESS=compress}
+: ${BENCH_TOOL=bench-tool}
+# Size of each part of the input in bytes. The input consists of logs, JSON
+# and binary data and must be large enough to give work to all threads.
+: ${BENCH_SIZE=33554432}
+: ${BENCH_ALGORITHMS="xz zstd lz4 bzip2"}
+: ${BENCH_RUNS=3}
+
+if test -z "$BENCH_THREADS"; then
+    cpus=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+    BENCH_THREADS=1
+    threads=2
+    while test $threads -lt "$cpus"; do
+        BENCH_THREADS="$BENCH_THREADS $threads"
+        threads=$((threads * 2))
+    done
+    test "$cpus" -gt 1 && BENCH_THREADS="$BENCH_THREADS $cpus"
+fi
+
+benchdir="$PWD/bench-threads"
+rm -rf "$benchdir"
+mkdir -p "$benchdir"
+cd "$benchdir"
+csv="$benchdir/threads.csv"
+
+exec < /dev/null
+
+"$BENCH_TOOL" corpus corpus "$BENCH_SIZE" || exit 1
+cat corpus/logs.txt corpus/data.json corpus/binary.bin > input
+rm -rf corpus
+size=$(wc -c < input)
+
+# Runs the command BENCH_RUNS times and prints the fastest time followed by
+# the maximum resident set size in KiB.
+measure() {
+    "$BENCH_TOOL" measure "$BENCH_RUNS" "$@"
+}
+
+echo "algorithm,threads,seconds,mb_s,speedup,efficiency,max_rss_kb," \
+    "rss_per_thread_kb" | tr -d ' ' > "$csv"
+printf '%-9s %7s %9s %9s %8s %10s %12s %12s\n' algorithm threads seconds \
+    "MB/s" speedup efficiency "peak KiB" "KiB/thread"
+
+fail=false
+for algo in $BENCH_ALGORITHMS; do
+    if ! echo | command $COMPRESS -m $algo -c > /dev/null 2>&1; then
+        echo "Skipping $algo because it is not supported."
+        continue
+    fi
+
+    base=
+    : > $algo.txt
+    for threads in $BENCH_THREADS; do
+        result=$(measure sh -c 'exec "$@" > /dev/null' sh \
+            $COMPRESS -c -m $algo -T $threads input) || fail=true
+        test -z "$base" && base=${result% *}
+        echo "$threads $result" >> $algo.txt
+        echo "$result" | awk -v algo=$algo -v threads=$threads -v size=$size \
+            -v base=$base -v csv="$csv" '{
+            speed = $1 > 0 ? size / $1 / 1e6 : 0
+            speedup = $1 > 0 ? base / $1 : 0
+            printf "%-9s %7d %9.3f %9.2f %8.2f %10.2f %12d %12d\n", algo,
+                threads, $1, speed, speedup, speedup / threads, $2,
+                $2 / threads
+            printf "%s,%d,%.6f,%.2f,%.3f,%.3f,%d,%d\n", algo, threads, $1,
+                speed, speedup, speedup / threads, $2, $2 / threads >> csv
+        }'
+    done
+done
+
+# Without -T the xz encoder limits its memory usage to a third of the physical
+# memory. Check that the peak memory usage stays below that limit and find
+# the number of threads whose memory usage matches.
+if test -r /proc/meminfo && test -e xz.txt; then
+    result=$(measure sh -c 'exec "$@" > /dev/null' sh \
+        $COMPRESS -c -m xz input) || fail=true
+    awk -v result="$result" '
+    FILENAME == "/proc/meminfo" {
+        if ($1 == "MemTotal:") limit = $2 / 3
+        next
+    }
+    { rss[$1] = $3 }
+    END {
+        split(result, r, " ")
+        for (t in rss) {
+            if (rss[t] <= r[2] * 1.05 && t + 0 > threads) threads = t + 0
+        }
+        printf "xz without -T: peak %d KiB of %d KiB allowed, " \
+            "like -T %d: %s\n", r[2], limit, threads,
+            r[2] <= limit ? "OK" : "LIMIT EXCEEDED"
+        if (r[2] > limit) exit 1
+    }' /proc/meminfo xz.txt || fail=true
+fi
+
+if $fail; then
+    echo "Some commands failed."
+    exit 1
+fi
+echo "Results written to $csv."
@@ -0,0 +1,296 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* bench-tool.c
+ * Helper for the benchmark scripts that generates the benchmark corpus and
+ * measures commands. This is not installed.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Number of files in the tree of small files.
+#define TREE_FILES 512
+#define TREE_DIRS 16
+
+static const char* words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "with",
+    "was", "on", "be", "by", "this", "are", "from", "or", "file", "data",
+    "compression", "algorithm", "request", "connection", "user", "error",
+    "value", "timeout", "server", "client", "memory", "buffer", "stream"
+};
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+static const char* hosts[] = { "alpha", "beta", "gamma", "delta", "epsilon" };
+static const char* levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN",
+        "ERROR" };
+
+// All data is generated from this fixed sequence so that every run of the
+// benchmark uses the same corpus.
+static uint32_t state = 2463534242;
+
+static uint32_t nextRandom(void) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static FILE* createFile(const char* dir, const char* name) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "bench-tool: cannot create '%s': %s\n", path,
+                strerror(errno));
+        exit(1);
+    }
+    return file;
+}
+
+static void closeFile(FILE* file) {
+    bool error = ferror(file);
+    if (fclose(file) != 0 || error) {
+        fprintf(stderr, "bench-tool: write error\n");
+        exit(1);
+    }
+}
+
+static void writeWords(FILE* file, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        // Prefer words at the start of the list like in natural text.
+        uint32_t r = nextRandom();
+        fputs(words[(r % NUM_WORDS) * (r / 7 % NUM_WORDS) / NUM_WORDS], file);
+        if (i + 1 < count) putc(' ', file);
+    }
+}
+
+static void generateLogs(const char* dir, long size) {
+    FILE* file = createFile(dir, "logs.txt");
+    long seconds = 1767225600;
+    while (ftell(file) < size) {
+        seconds += nextRandom() % 3;
+        time_t t = seconds;
+        struct tm* tm = gmtime(&t);
+        char date[32];
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", tm);
+        fprintf(file, "%s %s app[%u]: %s ", date, hosts[nextRandom() % 5],
+                1000 + nextRandom() % 64, levels[nextRandom() % 6]);
+        writeWords(file, 4 + nextRandom() % 12);
+        fprintf(file, " id=%08x\n", nextRandom());
+    }
+    closeFile(file);
+}
+
+static void generateJson(const char* dir, long size) {
+    FILE* file = createFile(dir, "data.json");
+    fputs("[\n", file);
+    for (unsigned int id = 1; ftell(file) < size; id++) {
+        fprintf(file, "  {\"id\": %u, \"name\": \"", id);
+        writeWords(file, 2);
+        fprintf(file, "\", \"active\": %s, \"score\": %u.%02u, \"tags\": [",
+                nextRandom() % 2 ? "true" : "false", nextRandom() % 1000,
+                nextRandom() % 100);
+        unsigned int tags = nextRandom() % 4;
+        for (unsigned int i = 0; i < tags; i++) {
+            fprintf(file, "%s\"%s\"", i ? ", " : "",
+                    words[nextRandom() % NUM_WORDS]);
+        }
+        fputs("]},\n", file);
+    }
+    fputs("  {}\n]\n", file);
+    closeFile(file);
+}
+
+static void generateBinary(const char* dir, long size) {
+    // Imitate machine code: a small set of frequent opcodes with mostly small
+    // operands, followed by a table of strings.
+    static const unsigned char opcodes[] = { 0x48, 0x89, 0x8b, 0xe8, 0xc3,
+            0x0f, 0x83, 0x85, 0x31, 0xff, 0x74, 0x75, 0x90, 0x55, 0x5d };
+    FILE* file = createFile(dir, "binary.bin");
+    long codeSize = size / 4 * 3;
+    for (long i = 0; i < codeSize; i += 6) {
+        uint32_t r = nextRandom();
+        putc(opcodes[r % sizeof(opcodes)], file);
+        putc(opcodes[r / 16 % sizeof(opcodes)], file);
+        uint32_t operand = r >> 24 < 200 ? r >> 26 : nextRandom();
+        for (int j = 0; j < 4; j++) {
+            putc(operand >> (8 * j) & 0xFF, file);
+        }
+    }
+    while (ftell(file) < size) {
+        writeWords(file, 1 + nextRandom() % 3);
+        putc('\0', file);
+    }
+    closeFile(file);
+}
+
+static void generateRandom(const char* dir, long size) {
+    FILE* file = createFile(dir, "random.bin");
+    for (long i = 0; i < size; i += 4) {
+        uint32_t r = nextRandom();
+        for (int j = 0; j < 4; j++) {
+            putc(r >> (8 * j) & 0xFF, file);
+        }
+    }
+    closeFile(file);
+}
+
+static void generateZeros(const char* dir, long size) {
+    FILE* file = createFile(dir, "zeros.bin");
+    for (long i = 0; i < size; i++) {
+        putc('\0', file);
+    }
+    closeFile(file);
+}
+
+static void generateSparse(const char* dir, long size) {
+    // The file has holes with a small amount of data in between.
+    FILE* file = createFile(dir, "sparse.bin");
+    int fd = fileno(file);
+    unsigned char block[4096];
+    for (long offset = 0; offset < size; offset += 256 * 1024) {
+        for (size_t i = 0; i < sizeof(block); i++) {
+            block[i] = nextRandom() % 16;
+        }
+        if (pwrite(fd, block, sizeof(block), offset) < 0 ||
+                ftruncate(fd, size) < 0) {
+            fprintf(stderr, "bench-tool: write error\n");
+            exit(1);
+        }
+    }
+    closeFile(file);
+}
+
+static void generateTree(const char* dir, long size) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/tree", dir);
+    mkdir(path, 0777);
+    for (int i = 0; i < TREE_DIRS; i++) {
+        snprintf(path, sizeof(path), "%s/tree/dir%02d", dir, i);
+        mkdir(path, 0777);
+    }
+
+    for (int i = 0; i < TREE_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/tree/dir%02d", dir, i % TREE_DIRS);
+        char name[32];
+        snprintf(name, sizeof(name), "file%03d.txt", i);
+        FILE* file = createFile(path, name);
+        // Most files are small and a few are larger.
+        long fileSize = nextRandom() % (size / TREE_FILES * 2 + 1);
+        while (ftell(file) < fileSize) {
+            writeWords(file, 8);
+            putc('\n', file);
+        }
+        closeFile(file);
+    }
+}
+
+static int generateCorpus(const char* dir, const char* sizeString) {
+    char* end;
+    long size = strtol(sizeString, &end, 10);
+    if (*end || size <= 0) {
+        fprintf(stderr, "bench-tool: invalid size '%s'\n", sizeString);
+        return 1;
+    }
+    mkdir(dir, 0777);
+    generateLogs(dir, size);
+    generateJson(dir, size);
+    generateBinary(dir, size);
+    generateRandom(dir, size);
+    generateZeros(dir, size);
+    generateSparse(dir, size);
+    generateTree(dir, size);
+    return 0;
+}
+
+// Runs the command and returns its exit status. The elapsed time and the
+// resource usage of the command are stored.
+static int runCommand(char* argv[], double* seconds, struct rusage* usage) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("bench-tool: fork");
+        return -1;
+    } else if (pid == 0) {
+        execvp(argv[0], argv);
+        fprintf(stderr, "bench-tool: cannot execute '%s': %s\n", argv[0],
+                strerror(errno));
+        _exit(127);
+    }
+
+    int status;
+    while (wait4(pid, &status, 0, usage) < 0) {
+        if (errno != EINTR) {
+            perror("bench-tool: wait4");
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *seconds = (end.tv_sec - start.tv_sec) +
+            (end.tv_nsec - start.tv_nsec) / 1e9;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Runs the command the given number of times and prints the fastest time
+// followed by the maximum resident set size in KiB of that run.
+static int measureCommand(const char* runsString, char* argv[]) {
+    char* end;
+    long runs = strtol(runsString, &end, 10);
+    if (*end || runs <= 0) {
+        fprintf(stderr, "bench-tool: invalid number of runs '%s'\n",
+                runsString);
+        return 1;
+    }
+
+    double best = 0;
+    long maxRss = 0;
+    for (long i = 0; i < runs; i++) {
+        double seconds;
+        struct rusage usage;
+        int status = runCommand(argv, &seconds, &usage);
+        if (status != 0) return status < 0 ? 1 : status;
+        if (i == 0 || seconds < best) {
+            best = seconds;
+            maxRss = usage.ru_maxrss;
+        }
+    }
+    printf("%.6f %ld\n", best, maxRss);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 4 && strcmp(argv[1], "corpus") == 0) {
+        return generateCorpus(argv[2], argv[3]);
+    } else if (argc >= 4 && strcmp(argv[1], "measure") == 0) {
+        return measureCommand(argv[2], argv + 3);
+    }
+
+    fputs("Usage: bench-tool corpus DIR SIZE\n"
+            "       bench-tool measure RUNS COMMAND [ARGUMENT...]\n", stderr);
+    return 1;
+}
@@ -0,0 +1,208 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* benchmark.c
+ * Measurement of compression and decompression speed.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "algorithm.h"
+
+#define BENCHMARK_ITERATIONS 3
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+struct measurement {
+    off_t compressedSize;
+    double compressTime;
+    double decompressTime;
+    size_t peakMemory;
+};
+
+// The data is kept in memory files so that the engines can use their usual
+// file descriptor interface without any disk I/O.
+static int createMemoryFile(void) {
+#if HAVE_MEMFD_CREATE
+    return memfd_create("dxcompress", MFD_CLOEXEC);
+#else
+    FILE* file = tmpfile();
+    if (!file) return -1;
+    int fd = dup(fileno(file));
+    fclose(file);
+    return fd;
+#endif
+}
+
+static double getTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int loadInput(int input, int memory, off_t* size) {
+    unsigned char buffer[COPY_BUFFER_SIZE];
+    *size = 0;
+    while (true) {
+        ssize_t bytesRead = read(input, buffer, sizeof(buffer));
+        if (bytesRead < 0) return RESULT_READ_ERROR;
+        if (bytesRead == 0) return RESULT_OK;
+        if (writeAll(memory, buffer, bytesRead) < 0) {
+            return RESULT_OUT_OF_MEMORY;
+        }
+        *size += bytesRead;
+    }
+}
+
+static int measure(const struct algorithm* algorithm, int level, int data,
+        off_t size, int compressed, struct measurement* measurement) {
+    struct memaccount* account = getThreadAccount();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        struct fileinfo info = {0};
+        if (lseek(data, 0, SEEK_SET) < 0 || ftruncate(compressed, 0) < 0 ||
+                lseek(compressed, 0, SEEK_SET) < 0) {
+            return RESULT_UNKNOWN_ERROR;
+        }
+        resetMemoryPeak(account);
+        double start = getTime();
+        int result = algorithm->compress(data, compressed, level, &info);
+        double time = getTime() - start;
+        if (result != RESULT_OK) return result;
+        if (i == 0 || time < measurement->compressTime) {
+            measurement->compressTime = time;
+        }
+        measurement->compressedSize = info.compressedSize;
+        size_t peak = atomic_load(&account->peak);
+        if (peak > measurement->peakMemory) measurement->peakMemory = peak;
+    }
+
+    // The beginning of the file is passed in a buffer like after probing.
+    unsigned char buffer[6];
+    ssize_t bufferSize = pread(compressed, buffer, sizeof(buffer), 0);
+    if (bufferSize < 0) return RESULT_READ_ERROR;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        struct fileinfo info = {0};
+        if (lseek(compressed, bufferSize, SEEK_SET) < 0) {
+            return RESULT_UNKNOWN_ERROR;
+        }
+        resetMemoryPeak(account);
+        double start = getTime();
+        int result = algorithm->decompress(compressed, -1, &info, buffer,
+                bufferSize);
+        double time = getTime() - start;
+        free((void*) info.name);
+        if (result != RESULT_OK) return result;
+        if (info.uncompressedSize != size) return RESULT_FORMAT_ERROR;
+        if (i == 0 || time < measurement->decompressTime) {
+            measurement->decompressTime = time;
+        }
+        size_t peak = atomic_load(&account->peak);
+        if (peak > measurement->peakMemory) measurement->peakMemory = peak;
+    }
+    return RESULT_OK;
+}
+
+static void printName(const char* name, bool csv) {
+    if (!csv || !strpbrk(name, ",\"\n")) {
+        fputs(name, stdout);
+        return;
+    }
+    putchar('"');
+    for (const char* p = name; *p; p++) {
+        if (*p == '"') putchar('"');
+        putchar(*p);
+    }
+    putchar('"');
+}
+
+static void printMeasurement(const struct algorithm* algorithm, int level,
+        off_t size, const struct measurement* measurement, const char* name,
+        bool csv) {
+    int nameLength = strcspn(algorithm->names, ",");
+    double ratio = measurement->compressedSize == 0 ? 0.0 :
+            (double) size / measurement->compressedSize;
+    double compressSpeed = measurement->compressTime > 0 ?
+            size / measurement->compressTime / 1e6 : 0.0;
+    double decompressSpeed = measurement->decompressTime > 0 ?
+            size / measurement->decompressTime / 1e6 : 0.0;
+
+    if (csv) {
+        printf("%.*s,%d,%jd,%jd,%.3f,%.2f,%.2f,%zu,", nameLength,
+                algorithm->names, level, (intmax_t) size,
+                (intmax_t) measurement->compressedSize, ratio, compressSpeed,
+                decompressSpeed, measurement->peakMemory);
+    } else {
+        printf("%-9.*s %5d %7.3f %10.1f %10.1f %10zu  ", nameLength,
+                algorithm->names, level, ratio, compressSpeed, decompressSpeed,
+                measurement->peakMemory / 1024);
+    }
+    printName(name, csv);
+    putchar('\n');
+}
+
+int benchmarkFile(int input, const char* name,
+        const struct algorithm* const* algorithms, int firstLevel,
+        int lastLevel, bool csv) {
+    int data = createMemoryFile();
+    if (data < 0) return RESULT_OUT_OF_MEMORY;
+    int compressed = createMemoryFile();
+    if (compressed < 0) {
+        close(data);
+        return RESULT_OUT_OF_MEMORY;
+    }
+
+    off_t size;
+    int result = loadInput(input, data, &size);
+    for (size_t i = 0; result == RESULT_OK && algorithms[i]; i++) {
+        const struct algorithm* algorithm = algorithms[i];
+        int first = firstLevel;
+        int last = lastLevel;
+        if (firstLevel == -1) {
+            first = last = algorithm->defaultLevel;
+        } else if (firstLevel == -2) {
+            first = last = algorithm->minLevel;
+        } else if (firstLevel == -3) {
+            first = last = algorithm->maxLevel;
+        } else {
+            // Ranges are limited to the levels supported by each algorithm.
+            int maxLevel = algorithm->ultraLevel ? algorithm->ultraLevel :
+                    algorithm->maxLevel;
+            if (first < algorithm->minLevel) first = algorithm->minLevel;
+            if (last > maxLevel) last = maxLevel;
+        }
+
+        for (int level = first; level <= last; level++) {
+            struct measurement measurement = {0};
+            result = measure(algorithm, level, data, size, compressed,
+                    &measurement);
+            if (result == RESULT_UNIMPLEMENTED_FORMAT) {
+                // Algorithms that were not built in are skipped.
+                result = RESULT_OK;
+                break;
+            }
+            if (result != RESULT_OK) break;
+            printMeasurement(algorithm, level, size, &measurement, name, csv);
+            fflush(stdout);
+        }
+        freeCaches();
+    }
+
+    close(data);
+    close(compressed);
+    return result;
+}
@@ -0,0 +1,753 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* bzip2.c
+ * Bzip2 compression.
+ */
+
+#include <config.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "algorithm.h"
+
+#if WITH_LIBBZ2
+#  include <bzlib.h>
+#endif
+
+static int bzip2Compress(int input, int output, int level,
+        struct fileinfo* info);
+static int bzip2Decompress(int input, int output, struct fileinfo* info,
+        const unsigned char* buffer, size_t bufferSize);
+static void bzip2FreeCache(void);
+static bool bzip2Probe(const unsigned char* buffer, size_t bufferSize);
+
+const struct algorithm algoBzip2 = {
+    .names = "bzip2",
+    .extensions = "bz2,tbz2:tar,tbz:tar",
+    .minLevel = 1,
+    .defaultLevel = 9,
+    .maxLevel = 9,
+    .compress = bzip2Compress,
+    .decompress = bzip2Decompress,
+    .probe = bzip2Probe,
+    .freeCache = bzip2FreeCache
+};
+
+#define BUFFER_SIZE (4096 * 8)
+
+static bool bzip2Probe(const unsigned char* buffer, size_t bufferSize) {
+    return bufferSize >= 4 && memcmp(buffer, "BZh", 3) == 0 &&
+            buffer[3] >= '1' && buffer[3] <= '9';
+}
+
+static void bzip2FreeCache(void) {
+    // Nothing is cached because every piece uses a new stream.
+}
+
+#if WITH_LIBBZ2
+// The input is split into pieces that are compressed in parallel into separate
+// bzip2 streams. The concatenation of these streams is a valid bzip2 file.
+// When decompressing, the blocks of all streams are located by searching for
+// the block magic number at every bit position. Each block is copied into a
+// stream of its own, so that libbz2 can decode the blocks in parallel.
+#define BLOCK_MAGIC UINT64_C(0x314159265359)
+#define END_MAGIC UINT64_C(0x177245385090)
+#define MAGIC_BITS 48
+// Compressed blocks are never larger than this. Since the magic number can
+// also occur in compressed data, a block that fails to decode is extended to
+// the next match until it reaches this size.
+#define MAX_BLOCK_SIZE (2 * 1024 * 1024)
+// The output of a block is decoded by a thread until it reaches this size.
+// Larger outputs are decoded again when they are written.
+#define MIN_BLOCK_OUTPUT (1024 * 1024)
+#define MAX_BLOCK_OUTPUT (4 * 1024 * 1024)
+#define READ_SIZE (256 * 1024)
+// Approximate memory needed by libbz2 and the buffers for each thread.
+#define COMPRESS_MEMORY (10 * 1024 * 1024)
+#define DECOMPRESS_MEMORY (12 * 1024 * 1024)
+
+struct piece {
+    struct memaccount* account;
+    const unsigned char* input;
+    size_t inputSize;
+    unsigned char* output;
+    size_t outputSize;
+    size_t outputCapacity;
+    int level;
+    int result;
+    // The fields below are only used for decompression. Positions are in bits
+    // from the start of the input.
+    uint64_t start;
+    // Position of the magic number that follows the block.
+    uint64_t end;
+    uint32_t crc;
+    // Whether the block is the last one of its stream.
+    bool streamEnd;
+    uint32_t streamCrc;
+    // Whether the output was larger than MAX_BLOCK_OUTPUT.
+    bool overflow;
+};
+
+struct decoder {
+    bz_stream stream;
+    bool active;
+};
+
+// Position in the input while searching for blocks. The data buffer contains
+// the input starting at byte dataOffset.
+struct scanner {
+    unsigned char* data;
+    size_t dataSize;
+    size_t capacity;
+    uint64_t dataOffset;
+    bool endOfFile;
+    // Block size of the current stream, or 0 between streams.
+    int level;
+    // Start of the current block, or of the next stream header when level is
+    // 0.
+    uint64_t position;
+    // Position where the search for the end of the current block continues.
+    uint64_t searchFrom;
+};
+
+static void* bzAlloc(void* opaque, int items, int size) {
+    if (items < 0 || size < 0 ||
+            (size != 0 && (size_t) items > SIZE_MAX / size)) {
+        return NULL;
+    }
+    return allocateMemory(opaque, (size_t) items * size);
+}
+
+static void bzFree(void* opaque, void* ptr) {
+    (void) opaque;
+    freeMemory(ptr);
+}
+
+static void initStream(bz_stream* stream, struct memaccount* account) {
+    memset(stream, 0, sizeof(*stream));
+    stream->bzalloc = bzAlloc;
+    stream->bzfree = bzFree;
+    stream->opaque = account;
+}
+
+static bool growOutput(struct piece* piece) {
+    size_t capacity = piece->outputCapacity * 2;
+    if (capacity < piece->outputCapacity) return false;
+    unsigned char* output = allocateMemory(piece->account, capacity);
+    if (!output) return false;
+    memcpy(output, piece->output, piece->outputSize);
+    freeMemory(piece->output);
+    piece->output = output;
+    piece->outputCapacity = capacity;
+    return true;
+}
+
+static uint32_t getBits(const struct scanner* scanner, uint64_t bit,
+        int count) {
+    uint32_t value = 0;
+    for (int i = 0; i < count; i++, bit++) {
+        unsigned char byte = scanner->data[bit / 8 - scanner->dataOffset];
+        value = value << 1 | (byte >> (7 - bit % 8) & 1);
+    }
+    return value;
+}
+
+static void putBits(unsigned char* buffer, uint64_t* bit, uint64_t value,
+        int count) {
+    for (int i = count - 1; i >= 0; i--, (*bit)++) {
+        unsigned char mask = 0x80 >> (*bit % 8);
+        if (value >> i & 1) {
+            buffer[*bit / 8] |= mask;
+        } else {
+            buffer[*bit / 8] &= ~mask;
+        }
+    }
+}
+
+// Returns whether the given number of bits from the position on are in the
+// data, reading more input if needed. Returns -1 on read errors.
+static int ensureBits(int input, struct scanner* scanner, uint64_t bit,
+        uint64_t count, off_t* totalIn) {
+    uint64_t end = (bit + count + 7) / 8;
+    while (scanner->dataOffset + scanner->dataSize < end) {
+        if (scanner->endOfFile || scanner->dataSize == scanner->capacity) {
+            return 0;
+        }
+        size_t readSize = scanner->capacity - scanner->dataSize;
+        if (readSize > READ_SIZE) readSize = READ_SIZE;
+        ssize_t bytesRead = readInput(input,
+                scanner->data + scanner->dataSize, readSize);
+        if (bytesRead < 0) return -1;
+        if (bytesRead == 0) scanner->endOfFile = true;
+        scanner->dataSize += bytesRead;
+        *totalIn += bytesRead;
+    }
+    return 1;
+}
+
+// Searches the data for a block or end of stream magic number starting at
+// *bit. Returns the magic number and stores its position in *bit. If none is
+// found, 0 is returned and *bit is set to where the search can continue once
+// there is more data.
+static uint64_t findMagic(const struct scanner* scanner, uint64_t* bit) {
+    uint64_t window = 0;
+    size_t first = *bit / 8 - scanner->dataOffset;
+    for (size_t i = first; i < scanner->dataSize; i++) {
+        window = window << 8 | scanner->data[i];
+        if (i - first < MAGIC_BITS / 8 - 1) continue;
+        // Matches that start earlier have a larger shift.
+        for (int shift = 7; shift >= 0; shift--) {
+            uint64_t candidate = window >> shift &
+                    ((UINT64_C(1) << MAGIC_BITS) - 1);
+            if (candidate != BLOCK_MAGIC && candidate != END_MAGIC) continue;
+            uint64_t position = (scanner->dataOffset + i + 1) * 8 - shift -
+                    MAGIC_BITS;
+            if (position < *bit) continue;
+            *bit = position;
+            return candidate;
+        }
+    }
+    uint64_t end = (scanner->dataOffset + scanner->dataSize) * 8;
+    if (end >= *bit + MAGIC_BITS) *bit = end - MAGIC_BITS + 1;
+    return 0;
+}
+
+// Returns 1 if a stream starts at the byte position, 0 if it does not and -1
+// on read errors.
+static int isStreamStart(int input, struct scanner* scanner, uint64_t bit,
+        off_t* totalIn) {
+    int status = ensureBits(input, scanner, bit, 32 + MAGIC_BITS, totalIn);
+    if (status <= 0) return status;
+    const unsigned char* p = scanner->data + bit / 8 - scanner->dataOffset;
+    if (p[0] != 'B' || p[1] != 'Z' || p[2] != 'h' || p[3] < '1' ||
+            p[3] > '9') {
+        return 0;
+    }
+    uint64_t magic = (uint64_t) getBits(scanner, bit + 32, 24) << 24 |
+            getBits(scanner, bit + 56, 24);
+    return magic == BLOCK_MAGIC || magic == END_MAGIC;
+}
+
+// Finds the next block and copies it into piece->input as a stream of its own.
+// Returns RESULT_OK and sets piece->inputSize to 0 when the input ends after a
+// stream.
+static int findBlock(int input, struct scanner* scanner, struct piece* piece,
+        off_t* totalIn) {
+    while (scanner->level == 0) {
+        int status = ensureBits(input, scanner, scanner->position, 8,
+                totalIn);
+        if (status < 0) return RESULT_READ_ERROR;
+        if (status == 0) {
+            piece->inputSize = 0;
+            return RESULT_OK;
+        }
+        status = isStreamStart(input, scanner, scanner->position, totalIn);
+        if (status < 0) return RESULT_READ_ERROR;
+        if (status == 0) return RESULT_FORMAT_ERROR;
+        scanner->level = scanner->data[scanner->position / 8 -
+                scanner->dataOffset + 3] - '0';
+        scanner->position += 32;
+
+        if (getBits(scanner, scanner->position, 24) == END_MAGIC >> 24) {
+            // An empty stream has a combined CRC of 0.
+            status = ensureBits(input, scanner, scanner->position,
+                    MAGIC_BITS + 32, totalIn);
+            if (status < 0) return RESULT_READ_ERROR;
+            if (status == 0 || getBits(scanner, scanner->position +
+                    MAGIC_BITS, 32) != 0) {
+                return RESULT_FORMAT_ERROR;
+            }
+            scanner->position += MAGIC_BITS + 32 + 7;
+            scanner->position &= ~(uint64_t) 7;
+            scanner->level = 0;
+        } else {
+            scanner->searchFrom = scanner->position + MAGIC_BITS + 32;
+        }
+    }
+
+    uint64_t end = scanner->searchFrom;
+    uint64_t magic;
+    while (true) {
+        magic = findMagic(scanner, &end);
+        if (magic == END_MAGIC) {
+            // The end of a stream must be followed by the end of the input or
+            // by another stream. Otherwise the magic number was part of the
+            // compressed data.
+            int status = ensureBits(input, scanner, end, MAGIC_BITS + 32,
+                    totalIn);
+            if (status < 0) return RESULT_READ_ERROR;
+            if (status == 0) return RESULT_FORMAT_ERROR;
+            uint64_t next = (end + MAGIC_BITS + 32 + 7) & ~(uint64_t) 7;
+            status = ensureBits(input, scanner, next, 8, totalIn);
+            if (status < 0) return RESULT_READ_ERROR;
+            if (status > 0) {
+                status = isStreamStart(input, scanner, next, totalIn);
+                if (status < 0) return RESULT_READ_ERROR;
+            } else {
+                status = scanner->endOfFile &&
+                        scanner->dataOffset + scanner->dataSize == next / 8;
+            }
+            if (status > 0) break;
+            end++;
+            continue;
+        }
+        if (magic == BLOCK_MAGIC) break;
+        if (end - scanner->position > (uint64_t) MAX_BLOCK_SIZE * 8) {
+            return RESULT_FORMAT_ERROR;
+        }
+        int status = ensureBits(input, scanner, end, MAGIC_BITS, totalIn);
+        if (status < 0) return RESULT_READ_ERROR;
+        if (status == 0) return RESULT_FORMAT_ERROR;
+    }
+    if (end - scanner->position > (uint64_t) MAX_BLOCK_SIZE * 8) {
+        return RESULT_FORMAT_ERROR;
+    }
+
+    // The combined CRC of a stream with a single block is the CRC of the
+    // block.
+    unsigned char* buffer = (unsigned char*) piece->input;
+    uint64_t start = scanner->position;
+    uint64_t bits = end - start;
+    memcpy(buffer, "BZh", 3);
+    buffer[3] = '0' + scanner->level;
+    size_t offset = start / 8 - scanner->dataOffset;
+    unsigned int shift = start % 8;
+    for (size_t i = 0; i < bits / 8; i++) {
+        const unsigned char* p = scanner->data + offset + i;
+        buffer[4 + i] = shift ? p[0] << shift | p[1] >> (8 - shift) : p[0];
+    }
+    uint64_t bit = 32 + bits / 8 * 8;
+    putBits(buffer, &bit, getBits(scanner, start + bits / 8 * 8, bits % 8),
+            bits % 8);
+    piece->crc = getBits(scanner, start + MAGIC_BITS, 32);
+    putBits(buffer, &bit, END_MAGIC, MAGIC_BITS);
+    putBits(buffer, &bit, piece->crc, 32);
+    if (bit % 8) putBits(buffer, &bit, 0, 8 - bit % 8);
+    piece->inputSize = bit / 8;
+    piece->start = start;
+    piece->end = end;
+    piece->level = scanner->level;
+
+    piece->streamEnd = magic == END_MAGIC;
+    if (piece->streamEnd) {
+        piece->streamCrc = getBits(scanner, end + MAGIC_BITS, 32);
+        scanner->position = (end + MAGIC_BITS + 32 + 7) & ~(uint64_t) 7;
+        scanner->level = 0;
+    } else {
+        scanner->position = end;
+        scanner->searchFrom = end + MAGIC_BITS + 32;
+    }
+    return RESULT_OK;
+}
+
+static void* compressPiece(void* arg) {
+    struct piece* piece = arg;
+    PROBE2(block, "bzip2", piece->inputSize);
+    bz_stream stream;
+    initStream(&stream, piece->account);
+    int status = BZ2_bzCompressInit(&stream, piece->level, 0, 0);
+    if (status != BZ_OK) {
+        piece->result = status == BZ_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
+                RESULT_UNKNOWN_ERROR;
+        return NULL;
+    }
+
+    stream.next_in = (char*) piece->input;
+    stream.avail_in = piece->inputSize;
+    stream.next_out = (char*) piece->output;
+    stream.avail_out = piece->outputCapacity;
+    do {
+        status = BZ2_bzCompress(&stream, BZ_FINISH);
+        if (status == BZ_FINISH_OK && stream.avail_out == 0) {
+            // This should not happen because the output buffer is large enough
+            // for incompressible data.
+            piece->outputSize = piece->outputCapacity;
+            if (!growOutput(piece)) {
+                status = BZ_MEM_ERROR;
+                break;
+            }
+            stream.next_out = (char*) piece->output + piece->outputSize;
+            stream.avail_out = piece->outputCapacity - piece->outputSize;
+        }
+    } while (status == BZ_FINISH_OK);
+
+    piece->outputSize = piece->outputCapacity - stream.avail_out;
+    piece->result = status == BZ_STREAM_END ? RESULT_OK :
+            status == BZ_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
+            RESULT_UNKNOWN_ERROR;
+    BZ2_bzCompressEnd(&stream);
+    return NULL;
+}
+
+static void* decompressPiece(void* arg) {
+    struct piece* piece = arg;
+    PROBE2(block, "bzip2", piece->inputSize);
+    piece->outputSize = 0;
+    piece->overflow = false;
+    bz_stream stream;
+    initStream(&stream, piece->account);
+    int status = BZ2_bzDecompressInit(&stream, 0, 0);
+    if (status != BZ_OK) {
+        piece->result = status == BZ_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
+                RESULT_UNKNOWN_ERROR;
+        return NULL;
+    }
+
+    stream.next_in = (char*) piece->input;
+    stream.avail_in = piece->inputSize;
+    do {
+        if (piece->outputSize == piece->outputCapacity) {
+            if (piece->outputCapacity >= MAX_BLOCK_OUTPUT) {
+                // The rest is only decoded to check that the block is valid.
+                piece->overflow = true;
+                piece->outputSize = 0;
+            } else if (!growOutput(piece)) {
+                status = BZ_MEM_ERROR;
+                break;
+            }
+        }
+        stream.next_out = (char*) piece->output + piece->outputSize;
+        stream.avail_out = piece->outputCapacity - piece->outputSize;
+        status = BZ2_bzDecompress(&stream);
+        piece->outputSize = (unsigned char*) stream.next_out - piece->output;
+    } while (status == BZ_OK &&
+            (stream.avail_in > 0 || stream.avail_out == 0));
+
+    piece->result = status == BZ_STREAM_END && stream.avail_in == 0 ?
+            RESULT_OK : status == BZ_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
+            RESULT_FORMAT_ERROR;
+    BZ2_bzDecompressEnd(&stream);
+    return NULL;
+}
+
+static void freePieces(struct piece* pieces, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        freeMemory((void*) pieces[i].input);
+        freeMemory(pieces[i].output);
+    }
+    freeMemory(pieces);
+}
+
+// Decompresses data sequentially. Concatenated streams are supported.
+static int decode(struct decoder* decoder, const unsigned char* data,
+        size_t size, int output, off_t* totalOut) {
+    bz_stream* stream = &decoder->stream;
+    PROBE2(block, "bzip2", size);
+    size_t offset = 0;
+
+    while (offset < size) {
+        if (!decoder->active) {
+            initStream(stream, getThreadAccount());
+            int status = BZ2_bzDecompressInit(stream, 0, 0);
+            if (status != BZ_OK) {
+                return status == BZ_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
+                        RESULT_UNKNOWN_ERROR;
+            }
+            decoder->active = true;
+        }
+        stream->next_in = (char*) data + offset;
+        stream->avail_in = size - offset;
+
+        int status;
+        do {
+            char outputBuffer[BUFFER_SIZE];
+            stream->next_out = outputBuffer;
+            stream->avail_out = sizeof(outputBuffer);
+            status = BZ2_bzDecompress(stream);
+            if (status != BZ_OK && status != BZ_STREAM_END) {
+                return status == BZ_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
+                        RESULT_FORMAT_ERROR;
+            }
+            size_t outputSize = sizeof(outputBuffer) - stream->avail_out;
+            if (writeAll(output, outputBuffer, outputSize) < 0) {
+                return RESULT_WRITE_ERROR;
+            }
+            *totalOut += outputSize;
+        } while (status == BZ_OK && (stream->avail_in > 0 ||
+                stream->avail_out == 0));
+
+        offset = size - stream->avail_in;
+        if (status == BZ_STREAM_END) {
+            BZ2_bzDecompressEnd(stream);
+            decoder->active = false;
+        }
+    }
+    return RESULT_OK;
+}
+
+// Decompresses the input without searching for blocks. This needs less memory
+// when there is only one thread.
+static int decompressSequentially(int input, int output,
+        struct fileinfo* info, const unsigned char* buffer,
+        size_t bufferSize) {
+    struct decoder decoder = { .active = false };
+    off_t totalIn = bufferSize;
+    off_t totalOut = 0;
+    int result = decode(&decoder, buffer, bufferSize, output, &totalOut);
+    while (result == RESULT_OK) {
+        info->compressedSize = totalIn;
+        info->uncompressedSize = totalOut;
+        if (!reportProgress(info)) {
+            result = RESULT_ABORTED;
+            break;
+        }
+
+        unsigned char inputBuffer[BUFFER_SIZE];
+        ssize_t bytesRead = readInput(input, inputBuffer, sizeof(inputBuffer));
+        if (bytesRead < 0) {
+            result = RESULT_READ_ERROR;
+            break;
+        }
+        if (bytesRead == 0) break;
+        totalIn += bytesRead;
+        result = decode(&decoder, inputBuffer, bytesRead, output, &totalOut);
+    }
+
+    // The input ended within a stream.
+    if (decoder.active) {
+        BZ2_bzDecompressEnd(&decoder.stream);
+        if (result == RESULT_OK) result = RESULT_FORMAT_ERROR;
+    }
+
+    info->compressedSize = totalIn;
+    info->uncompressedSize = totalOut;
+    info->crc = -1;
+    return result;
+}
+#endif
+
+static int bzip2Compress(int input, int output, int level,
+        struct fileinfo* info) {
+#if WITH_LIBBZ2
+    size_t threads = getThreadCount(COMPRESS_MEMORY);
+    struct memaccount* account = getThreadAccount();
+    struct piece* pieces = allocateMemory(account,
+            threads * sizeof(struct piece));
+    if (!pieces) return RESULT_OUT_OF_MEMORY;
+    memset(pieces, 0, threads * sizeof(struct piece));
+
+    // Each piece fills exactly one bzip2 block of the selected size.
+    size_t pieceSize = level * 100000;
+    size_t outputCapacity = pieceSize + pieceSize / 100 + 600;
+    for (size_t i = 0; i < threads; i++) {
+        pieces[i].account = account;
+        pieces[i].level = level;
+        pieces[i].input = allocateMemory(account, pieceSize);
+        pieces[i].output = allocateMemory(account, outputCapacity);
+        pieces[i].outputCapacity = outputCapacity;
+        if (!pieces[i].input || !pieces[i].output) {
+            freePieces(pieces, threads);
+            return RESULT_OUT_OF_MEMORY;
+        }
+    }
+
+    int result = RESULT_OK;
+    bool endOfFile = false;
+    info->uncompressedSize = 0;
+    info->compressedSize = 0;
+
+    while (!endOfFile && result == RESULT_OK) {
+        if (!reportProgress(info)) {
+            result = RESULT_ABORTED;
+            break;
+        }
+
+        size_t count = 0;
+        while (count < threads && !endOfFile) {
+            unsigned char* buffer = (unsigned char*) pieces[count].input;
+            size_t bytesRead = 0;
+            while (bytesRead < pieceSize) {
+                ssize_t size = readInput(input, buffer + bytesRead,
+                        pieceSize - bytesRead);
+                if (size < 0) {
+                    result = RESULT_READ_ERROR;
+                    break;
+                }
+                if (size == 0) {
+                    endOfFile = true;
+                    break;
+                }
+                bytesRead += size;
+            }
+            if (result != RESULT_OK) break;
+            // An empty file still needs a stream.
+            if (bytesRead == 0 && (count > 0 || info->uncompressedSize > 0)) {
+                break;
+            }
+            pieces[count].inputSize = bytesRead;
+            count++;
+        }
+        if (result != RESULT_OK) break;
+
+        if ((int) count > info->threads) info->threads = count;
+        runParallel(compressPiece, pieces, sizeof(struct piece), count);
+
+        for (size_t i = 0; i < count; i++) {
+            if (pieces[i].result != RESULT_OK) {
+                result = pieces[i].result;
+                break;
+            }
+            if (writeAll(output, pieces[i].output, pieces[i].outputSize) < 0) {
+                result = RESULT_WRITE_ERROR;
+                break;
+            }
+            info->uncompressedSize += pieces[i].inputSize;
+            info->compressedSize += pieces[i].outputSize;
+        }
+    }
+
+    freePieces(pieces, threads);
+    return result;
+#else
+    (void) input; (void) output; (void) level; (void) info;
+    return RESULT_UNIMPLEMENTED_FORMAT;
+#endif
+}
+
+static int bzip2Decompress(int input, int output, struct fileinfo* info,
+        const unsigned char* buffer, size_t bufferSize) {
+#if WITH_LIBBZ2
+    reportHeader(info);
+    if (output == -2) {
+        output = openOutputFile(NULL, info->oinfo);
+        if (output < 0) return RESULT_OPEN_FAILURE;
+    }
+
+    size_t threads = getThreadCount(DECOMPRESS_MEMORY);
+    if (threads == 1) {
+        return decompressSequentially(input, output, info, buffer,
+                bufferSize);
+    }
+
+    struct memaccount* account = getThreadAccount();
+    struct piece* pieces = allocateMemory(account,
+            threads * sizeof(struct piece));
+    if (!pieces) return RESULT_OUT_OF_MEMORY;
+    memset(pieces, 0, threads * sizeof(struct piece));
+    // Blocks are kept from the start of the batch so that a block can still be
+    // extended when it fails to decode.
+    struct scanner scanner = {
+        .capacity = (threads + 1) * MAX_BLOCK_SIZE + READ_SIZE
+    };
+    scanner.data = allocateMemory(account, scanner.capacity);
+    bool allocated = scanner.data != NULL;
+    for (size_t i = 0; i < threads; i++) {
+        pieces[i].account = account;
+        // The header, end of stream and padding are added to the block.
+        pieces[i].input = allocateMemory(account, MAX_BLOCK_SIZE + 16);
+        pieces[i].output = allocateMemory(account, MIN_BLOCK_OUTPUT);
+        pieces[i].outputCapacity = MIN_BLOCK_OUTPUT;
+        if (!pieces[i].input || !pieces[i].output) allocated = false;
+    }
+    if (!allocated) {
+        freePieces(pieces, threads);
+        freeMemory(scanner.data);
+        return RESULT_OUT_OF_MEMORY;
+    }
+
+    memcpy(scanner.data, buffer, bufferSize);
+    scanner.dataSize = bufferSize;
+    off_t totalIn = bufferSize;
+    off_t totalOut = 0;
+    uint32_t streamCrc = 0;
+    bool endOfInput = false;
+    int result = RESULT_OK;
+    struct decoder decoder = { .active = false };
+
+    while (result == RESULT_OK && !endOfInput) {
+        info->compressedSize = totalIn;
+        info->uncompressedSize = totalOut;
+        if (!reportProgress(info)) {
+            result = RESULT_ABORTED;
+            break;
+        }
+
+        size_t discard = scanner.position / 8 - scanner.dataOffset;
+        memmove(scanner.data, scanner.data + discard,
+                scanner.dataSize - discard);
+        scanner.dataOffset += discard;
+        scanner.dataSize -= discard;
+
+        size_t count = 0;
+        while (count < threads) {
+            result = findBlock(input, &scanner, &pieces[count], &totalIn);
+            if (result != RESULT_OK) break;
+            if (pieces[count].inputSize == 0) {
+                endOfInput = true;
+                break;
+            }
+            count++;
+        }
+        if (result != RESULT_OK) break;
+
+        if ((int) count > info->threads) info->threads = count;
+        runParallel(decompressPiece, pieces, sizeof(struct piece), count);
+
+        for (size_t i = 0; i < count; i++) {
+            struct piece* piece = &pieces[i];
+            while (piece->result == RESULT_FORMAT_ERROR) {
+                // The magic number after the block might have been part of
+                // the compressed data. Extend the block to the next magic
+                // number and discard the blocks that were found after it.
+                scanner.level = piece->level;
+                scanner.position = piece->start;
+                scanner.searchFrom = piece->end + 1;
+                result = findBlock(input, &scanner, piece, &totalIn);
+                if (result != RESULT_OK) break;
+                decompressPiece(piece);
+                count = i + 1;
+                endOfInput = false;
+            }
+            if (result == RESULT_OK) result = piece->result;
+            if (result != RESULT_OK) break;
+
+            if (piece->overflow) {
+                // Decode the block again without keeping the whole output.
+                result = decode(&decoder, piece->input, piece->inputSize,
+                        output, &totalOut);
+                if (result != RESULT_OK) break;
+            } else {
+                if (writeAll(output, piece->output, piece->outputSize) < 0) {
+                    result = RESULT_WRITE_ERROR;
+                    break;
+                }
+                totalOut += piece->outputSize;
+            }
+
+            streamCrc = (streamCrc << 1 | streamCrc >> 31) ^ piece->crc;
+            if (piece->streamEnd) {
+                if (streamCrc != piece->streamCrc) {
+                    result = RESULT_FORMAT_ERROR;
+                    break;
+                }
+                streamCrc = 0;
+            }
+        }
+    }
+
+    if (decoder.active) BZ2_bzDecompressEnd(&decoder.stream);
+    freePieces(pieces, threads);
+    freeMemory(scanner.data);
+
+    info->compressedSize = totalIn;
+    info->uncompressedSize = totalOut;
+    info->crc = -1;
+    return result;
+#else
+    (void) input; (void) output; (void) info; (void) buffer; (void) bufferSize;
+    return RESULT_UNIMPLEMENTED_FORMAT;
+#endif
+}
@@ -0,0 +1,302 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* calibrate.c
+ * Measurement of compression speed and ratio on this machine.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "algorithm.h"
+
+// Configurations that are considered for automatic selection. The LZW entry is
+// always available and is used as the reference for estimating ratios.
+static struct calibration profile[] = {
+    { &algoLzw, 16, 0, 0 },
+    { &algoLz4, 1, 0, 0 },
+    { &algoLz4, 9, 0, 0 },
+    { &algoZstd, 1, 0, 0 },
+    { &algoZstd, 3, 0, 0 },
+    { &algoZstd, 9, 0, 0 },
+    { &algoZstd, 19, 0, 0 },
+    { &algoDeflate, 1, 0, 0 },
+    { &algoDeflate, 6, 0, 0 },
+    { &algoDeflate, 9, 0, 0 },
+    { &algoBzip2, 9, 0, 0 },
+    { &algoXz, 1, 0, 0 },
+    { &algoXz, 6, 0, 0 },
+    { &algoXz, 9, 0, 0 },
+};
+
+#define PROFILE_SIZE (sizeof(profile) / sizeof(profile[0]))
+#define CORPUS_SIZE (1024 * 1024)
+#define CHUNK_SIZE (64 * 1024)
+
+// The profile must be measured again when the set of supported algorithms
+// changes.
+#define PROFILE_HEADER "dxcompress calibration 1 " \
+        WITH_ZLIB_STRING WITH_LIBLZMA_STRING WITH_LIBBZ2_STRING \
+        WITH_LIBLZ4_STRING WITH_LIBZSTD_STRING
+
+#if WITH_ZLIB
+#  define WITH_ZLIB_STRING "z"
+#else
+#  define WITH_ZLIB_STRING ""
+#endif
+#if WITH_LIBLZMA
+#  define WITH_LIBLZMA_STRING "x"
+#else
+#  define WITH_LIBLZMA_STRING ""
+#endif
+#if WITH_LIBBZ2
+#  define WITH_LIBBZ2_STRING "b"
+#else
+#  define WITH_LIBBZ2_STRING ""
+#endif
+#if WITH_LIBLZ4
+#  define WITH_LIBLZ4_STRING "l"
+#else
+#  define WITH_LIBLZ4_STRING ""
+#endif
+#if WITH_LIBZSTD
+#  define WITH_LIBZSTD_STRING "s"
+#else
+#  define WITH_LIBZSTD_STRING ""
+#endif
+
+static const char* const words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "with",
+    "was", "on", "be", "by", "this", "file", "data", "value", "error",
+    "compress", "return", "static", "struct", "const", "size", "buffer",
+    "output", "input", "level", "algorithm", "stream", "block", "thread",
+};
+
+static uint32_t nextRandom(uint32_t* state) {
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+// Creates data that is a mix of text, structured binary data and random data.
+static void generateCorpus(unsigned char* corpus) {
+    uint32_t state = 1;
+    size_t numWords = sizeof(words) / sizeof(words[0]);
+
+    for (size_t chunk = 0; chunk < CORPUS_SIZE; chunk += CHUNK_SIZE) {
+        unsigned char* p = corpus + chunk;
+        unsigned char* end = p + CHUNK_SIZE;
+        int kind = chunk / CHUNK_SIZE % 4;
+        if (kind <= 1) {
+            while (p < end) {
+                // Prefer words at the start of the list.
+                uint32_t r = nextRandom(&state);
+                const char* word = words[(r % numWords) * (r / 7 % numWords) /
+                        numWords];
+                size_t length = strlen(word);
+                if ((size_t) (end - p) < length + 1) length = end - p - 1;
+                memcpy(p, word, length);
+                p += length;
+                *p++ = r % 13 == 0 ? '\n' : ' ';
+            }
+        } else if (kind == 2) {
+            uint32_t value = 0;
+            for (; p + 4 <= end; p += 4) {
+                value += nextRandom(&state) % 16;
+                p[0] = value;
+                p[1] = value >> 8;
+                p[2] = value >> 16;
+                p[3] = value >> 24;
+            }
+        } else {
+            while (p < end) {
+                *p++ = nextRandom(&state);
+            }
+        }
+    }
+}
+
+char* getCachePath(const char* name, bool create) {
+    const char* cacheDir = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char* dir;
+    if (cacheDir && *cacheDir) {
+        dir = malloc(strlen(cacheDir) + sizeof("/dxcompress"));
+        if (!dir) return NULL;
+        if (create) mkdir(cacheDir, 0777);
+        stpcpy(stpcpy(dir, cacheDir), "/dxcompress");
+    } else if (home && *home) {
+        dir = malloc(strlen(home) + sizeof("/.cache/dxcompress"));
+        if (!dir) return NULL;
+        stpcpy(stpcpy(dir, home), "/.cache");
+        if (create) mkdir(dir, 0777);
+        strcat(dir, "/dxcompress");
+    } else {
+        return NULL;
+    }
+
+    if (create && mkdir(dir, 0777) < 0 && errno != EEXIST) {
+        free(dir);
+        return NULL;
+    }
+
+    char* path = malloc(strlen(dir) + strlen(name) + 2);
+    if (path) stpcpy(stpcpy(stpcpy(path, dir), "/"), name);
+    free(dir);
+    return path;
+}
+
+static bool loadProfile(void) {
+    char* path = getCachePath("calibration", false);
+    if (!path) return false;
+    FILE* file = fopen(path, "r");
+    free(path);
+    if (!file) return false;
+
+    char line[256];
+    bool valid = fgets(line, sizeof(line), file) &&
+            strcmp(line, PROFILE_HEADER "\n") == 0;
+    for (size_t i = 0; valid && i < PROFILE_SIZE; i++) {
+        char name[32];
+        int level;
+        if (!fgets(line, sizeof(line), file) ||
+                sscanf(line, "%31s %d %lf %lf", name, &level,
+                &profile[i].speed, &profile[i].ratio) != 4 ||
+                strcspn(profile[i].algorithm->names, ",") != strlen(name) ||
+                strncmp(profile[i].algorithm->names, name, strlen(name)) != 0 ||
+                level != profile[i].level) {
+            valid = false;
+        }
+    }
+    fclose(file);
+    return valid;
+}
+
+static void saveProfile(void) {
+    char* path = getCachePath("calibration", true);
+    if (!path) return;
+    FILE* file = fopen(path, "w");
+    free(path);
+    if (!file) return;
+
+    fputs(PROFILE_HEADER "\n", file);
+    for (size_t i = 0; i < PROFILE_SIZE; i++) {
+        const char* names = profile[i].algorithm->names;
+        fprintf(file, "%.*s %d %.0f %.6f\n", (int) strcspn(names, ","),
+                names, profile[i].level, profile[i].speed, profile[i].ratio);
+    }
+    fclose(file);
+}
+
+static void measureProfile(void) {
+    unsigned char* corpus = malloc(CORPUS_SIZE);
+    FILE* file = tmpfile();
+    if (!corpus || !file) {
+        free(corpus);
+        if (file) fclose(file);
+        return;
+    }
+    generateCorpus(corpus);
+    int fd = fileno(file);
+    bool written = writeAll(fd, corpus, CORPUS_SIZE) == CORPUS_SIZE;
+    free(corpus);
+    if (!written) {
+        fclose(file);
+        return;
+    }
+
+    // Measure the configurations without adjusting their levels.
+    uint64_t savedTargetSpeed = targetSpeed;
+    targetSpeed = 0;
+    for (size_t i = 0; i < PROFILE_SIZE; i++) {
+        struct calibration* entry = &profile[i];
+        struct fileinfo info = {0};
+        lseek(fd, 0, SEEK_SET);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int result = entry->algorithm->compress(fd, -1, entry->level, &info);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) +
+                (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        if (result != RESULT_OK || info.uncompressedSize == 0) {
+            // Unsupported algorithms have a speed of 0.
+            entry->speed = 0;
+            entry->ratio = 1;
+        } else {
+            entry->speed = seconds > 0 ? CORPUS_SIZE / seconds : 1e12;
+            entry->ratio = (double) info.compressedSize / CORPUS_SIZE;
+        }
+    }
+    targetSpeed = savedTargetSpeed;
+    fclose(file);
+    freeCaches();
+}
+
+const struct calibration* getCalibration(size_t* count, bool verbose) {
+    static bool loaded;
+    if (!loaded) {
+        if (!loadProfile()) {
+            if (verbose) {
+                fputs("Calibrating compression speed...\n", stderr);
+            }
+            measureProfile();
+            saveProfile();
+        }
+        loaded = true;
+    }
+    *count = PROFILE_SIZE;
+    return profile;
+}
+
+const struct calibration* chooseConfiguration(double sampleRatio,
+        uint64_t targetSpeed, double targetRatio) {
+    size_t count;
+    const struct calibration* entries = getCalibration(&count, false);
+
+    // Ratios measured on the calibration data are scaled by how well the
+    // sample compressed compared to the reference.
+    double scale = 1.0;
+    if (sampleRatio > 0 && entries[0].ratio > 0) {
+        scale = sampleRatio / entries[0].ratio;
+    }
+
+    // Among the configurations that are fast enough choose the fastest one
+    // that reaches the target ratio, or otherwise the one with the best ratio.
+    const struct calibration* fastest = &entries[0];
+    const struct calibration* smallest = NULL;
+    const struct calibration* fastestOnTarget = NULL;
+    for (size_t i = 0; i < count; i++) {
+        const struct calibration* entry = &entries[i];
+        if (entry->speed == 0) continue;
+        if (entry->speed > fastest->speed) fastest = entry;
+        if (entry->speed < targetSpeed) continue;
+
+        if (!smallest || entry->ratio < smallest->ratio) smallest = entry;
+        if (targetRatio > 0 && entry->ratio * scale * targetRatio <= 1.0 &&
+                (!fastestOnTarget || entry->speed > fastestOnTarget->speed)) {
+            fastestOnTarget = entry;
+        }
+    }
+
+    if (fastestOnTarget) return fastestOnTarget;
+    // If no configuration is fast enough we use the fastest one.
+    return smallest ? smallest : fastest;
+}
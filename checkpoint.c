@@ -0,0 +1,215 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* checkpoint.c
+ * Resumable compression of large files.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "algorithm.h"
+
+#define CHECKPOINT_HEADER "dxcompress checkpoint 1"
+#define COPY_BUFFER_SIZE (64 * 1024)
+#define PIPE_SIZE (1024 * 1024)
+
+// The input is split into segments that are compressed as separate gzip
+// members or streams. After each segment the input offset and the length of
+// the output are a consistent cut from which compression can be resumed.
+struct segment {
+    int input;
+    int output;
+    uint64_t copied;
+    bool readError;
+};
+
+static void* copySegment(void* arg) {
+    struct segment* segment = arg;
+
+    // When the encoder fails the write fails with EPIPE. The signal stays
+    // pending on this thread and is discarded when it exits.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    unsigned char* buffer = malloc(COPY_BUFFER_SIZE);
+    segment->readError = !buffer;
+    while (buffer && segment->copied < checkpointInterval) {
+        size_t size = COPY_BUFFER_SIZE;
+        if (checkpointInterval - segment->copied < size) {
+            size = checkpointInterval - segment->copied;
+        }
+        ssize_t bytesRead = readInput(segment->input, buffer, size);
+        if (bytesRead < 0) segment->readError = true;
+        if (bytesRead <= 0) break;
+        if (writeAll(segment->output, buffer, bytesRead) < 0) break;
+        segment->copied += bytesRead;
+    }
+    free(buffer);
+    close(segment->output);
+    return NULL;
+}
+
+static bool saveCheckpoint(const char* path, const struct stat* inputStat,
+        off_t inputOffset, off_t outputOffset) {
+    // The checkpoint is replaced atomically so that a valid checkpoint exists
+    // at any time.
+    char* tempPath = malloc(strlen(path) + sizeof(".tmp"));
+    if (!tempPath) return false;
+    stpcpy(stpcpy(tempPath, path), ".tmp");
+    FILE* file = fopen(tempPath, "w");
+    if (!file) {
+        free(tempPath);
+        return false;
+    }
+
+    fprintf(file, CHECKPOINT_HEADER "\n%jx %jx %jd %jd %ld %jd %jd\n",
+            (uintmax_t) inputStat->st_dev, (uintmax_t) inputStat->st_ino,
+            (intmax_t) inputStat->st_size, (intmax_t) inputStat->st_mtim.tv_sec,
+            inputStat->st_mtim.tv_nsec, (intmax_t) inputOffset,
+            (intmax_t) outputOffset);
+    bool success = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    success = fclose(file) == 0 && success && rename(tempPath, path) == 0;
+    if (!success) {
+        int savedErrno = errno;
+        unlink(tempPath);
+        errno = savedErrno;
+    }
+    free(tempPath);
+    return success;
+}
+
+int compressCheckpointed(int input, int output,
+        const struct algorithm* algorithm, int level, struct fileinfo* info,
+        const char* path, bool* checkpointed) {
+    struct stat inputStat;
+    if (fstat(input, &inputStat) < 0) return RESULT_READ_ERROR;
+    off_t inputOffset = lseek(input, 0, SEEK_CUR);
+    if (inputOffset < 0) return RESULT_READ_ERROR;
+    off_t outputOffset = lseek(output, 0, SEEK_CUR);
+    if (outputOffset < 0) return RESULT_WRITE_ERROR;
+    // When resuming the sizes include the segments that were already
+    // compressed so that the ratio is that of the whole file.
+    off_t startIn = inputOffset;
+    off_t startOut = outputOffset;
+    off_t totalIn = startIn;
+    off_t totalOut = startOut;
+
+    while (true) {
+        int fds[2];
+        if (pipe(fds) < 0) return RESULT_UNKNOWN_ERROR;
+#ifdef F_SETPIPE_SZ
+        fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+#endif
+        struct segment segment = { input, fds[1], 0, false };
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, copySegment, &segment) != 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return RESULT_UNKNOWN_ERROR;
+        }
+
+        struct fileinfo segmentInfo = *info;
+        int result = algorithm->compress(fds[0], output, level, &segmentInfo);
+        close(fds[0]);
+        pthread_join(thread, NULL);
+        if (result == RESULT_OK && segment.readError) {
+            result = RESULT_READ_ERROR;
+        }
+        totalIn += segmentInfo.uncompressedSize;
+        totalOut += segmentInfo.compressedSize;
+        info->uncompressedSize = totalIn;
+        info->compressedSize = totalOut;
+        if (segmentInfo.threads > info->threads) {
+            info->threads = segmentInfo.threads;
+        }
+        // The engine reports the sizes of each segment on its own. Progress
+        // only counts the part of the file that is compressed by this run.
+        setProgressOffset(totalIn - startIn, totalOut - startOut);
+        if (result != RESULT_OK) return result;
+
+        inputOffset += segment.copied;
+        outputOffset = lseek(output, 0, SEEK_CUR);
+        if (outputOffset < 0) return RESULT_WRITE_ERROR;
+        if (segment.copied < checkpointInterval ||
+                inputOffset >= inputStat.st_size) {
+            break;
+        }
+
+        // The output must be on disk before the checkpoint refers to it.
+        if (fdatasync(output) < 0) return RESULT_WRITE_ERROR;
+        if (saveCheckpoint(path, &inputStat, inputOffset, outputOffset)) {
+            *checkpointed = true;
+        } else {
+            printWarning("cannot save checkpoint '%s': %s", path,
+                    strerror(errno));
+        }
+    }
+
+    unlink(path);
+    *checkpointed = false;
+    return RESULT_OK;
+}
+
+int resumeCheckpoint(const char* path, int input, int dirFd,
+        const char* outputName) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+    char line[256];
+    uintmax_t device, inode;
+    intmax_t size, seconds, inputOffset, outputOffset;
+    long nanoseconds;
+    bool valid = fgets(line, sizeof(line), file) &&
+            strcmp(line, CHECKPOINT_HEADER "\n") == 0 &&
+            fscanf(file, "%jx %jx %jd %jd %ld %jd %jd", &device, &inode, &size,
+            &seconds, &nanoseconds, &inputOffset, &outputOffset) == 7;
+    fclose(file);
+
+    // The input must not have changed since the checkpoint was written.
+    struct stat inputStat;
+    if (!valid || fstat(input, &inputStat) < 0 ||
+            device != (uintmax_t) inputStat.st_dev ||
+            inode != (uintmax_t) inputStat.st_ino ||
+            size != inputStat.st_size ||
+            seconds != inputStat.st_mtim.tv_sec ||
+            nanoseconds != inputStat.st_mtim.tv_nsec ||
+            inputOffset < 0 || inputOffset > size || outputOffset < 0) {
+        return -1;
+    }
+
+    int output = openat(dirFd, outputName, O_WRONLY | O_NOFOLLOW);
+    if (output < 0) return -1;
+    struct stat outputStat;
+    if (fstat(output, &outputStat) < 0 || !S_ISREG(outputStat.st_mode) ||
+            outputStat.st_size < outputOffset ||
+            ftruncate(output, outputOffset) < 0 ||
+            lseek(output, outputOffset, SEEK_SET) < 0 ||
+            lseek(input, inputOffset, SEEK_SET) < 0) {
+        close(output);
+        lseek(input, 0, SEEK_SET);
+        return -1;
+    }
+    return output;
+}
@@ -0,0 +1,122 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* classify.c
+ * Detection of files that are not worth compressing.
+ */
+
+#include <config.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "algorithm.h"
+
+struct magic {
+    size_t offset;
+    size_t length;
+    const char* bytes;
+};
+
+// File formats that are already compressed or encrypted.
+static const struct magic magics[] = {
+    { 0, 2, "\x1F\x8B" }, // gzip
+    { 0, 2, "\x1F\x9D" }, // compress
+    { 0, 6, "\xFD""7zXZ\0" }, // xz
+    { 0, 4, "LZIP" }, // lzip
+    { 0, 3, "BZh" }, // bzip2
+    { 0, 4, "\x28\xB5\x2F\xFD" }, // zstd
+    { 0, 4, "\x04\x22\x4D\x18" }, // lz4
+    { 0, 4, "PK\x03\x04" }, // zip, jar, docx, ...
+    { 0, 6, "7z\xBC\xAF\x27\x1C" }, // 7z
+    { 0, 6, "Rar!\x1A\x07" }, // rar
+    { 0, 3, "\xFF\xD8\xFF" }, // jpeg
+    { 0, 8, "\x89PNG\r\n\x1A\n" }, // png
+    { 0, 4, "GIF8" }, // gif
+    { 8, 4, "WEBP" }, // webp
+    { 4, 4, "ftyp" }, // mp4, mov, heic, ...
+    { 0, 4, "\x1A\x45\xDF\xA3" }, // matroska, webm
+    { 0, 4, "OggS" }, // ogg
+    { 0, 4, "fLaC" }, // flac
+    { 0, 3, "ID3" }, // mp3
+};
+
+#define SAMPLE_SIZE (16 * 1024)
+#define SAMPLE_COUNT 4
+// Files smaller than this are only classified by their magic number because the
+// entropy estimate is not meaningful for little data.
+#define MIN_ENTROPY_SIZE 4096
+// Entropy in bits per byte above which data is considered incompressible.
+#define ENTROPY_THRESHOLD 7.9
+
+static double entropy(const unsigned char* buffer, size_t size) {
+    // Counting into multiple tables avoids stalls when consecutive bytes are
+    // equal and lets the CPU execute the increments in parallel.
+    uint32_t counts[4][256] = {{0}};
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        counts[0][buffer[i]]++;
+        counts[1][buffer[i + 1]]++;
+        counts[2][buffer[i + 2]]++;
+        counts[3][buffer[i + 3]]++;
+    }
+    for (; i < size; i++) {
+        counts[0][buffer[i]]++;
+    }
+
+    double result = 0.0;
+    for (size_t c = 0; c < 256; c++) {
+        uint32_t count = counts[0][c] + counts[1][c] + counts[2][c] +
+                counts[3][c];
+        if (count == 0) continue;
+        double p = (double) count / (double) size;
+        result -= p * log2(p);
+    }
+    return result;
+}
+
+static bool hasMagic(const unsigned char* buffer, size_t size) {
+    for (size_t i = 0; i < sizeof(magics) / sizeof(magics[0]); i++) {
+        const struct magic* magic = &magics[i];
+        if (magic->offset + magic->length <= size &&
+                memcmp(buffer + magic->offset, magic->bytes,
+                magic->length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isIncompressible(int fd, off_t size) {
+    unsigned char buffer[SAMPLE_SIZE];
+
+    ssize_t bytesRead = pread(fd, buffer, sizeof(buffer), 0);
+    if (bytesRead <= 0) return false;
+    if (hasMagic(buffer, bytesRead)) return true;
+    if (size < MIN_ENTROPY_SIZE || bytesRead < MIN_ENTROPY_SIZE) return false;
+
+    // Sample blocks spread over the whole file. The file is only considered
+    // incompressible if all of them are.
+    if (entropy(buffer, bytesRead) < ENTROPY_THRESHOLD) return false;
+    if (size <= SAMPLE_SIZE) return true;
+
+    for (int i = 1; i < SAMPLE_COUNT; i++) {
+        off_t offset = (size - SAMPLE_SIZE) / (SAMPLE_COUNT - 1) * i;
+        bytesRead = pread(fd, buffer, sizeof(buffer), offset);
+        if (bytesRead < MIN_ENTROPY_SIZE) return false;
+        if (entropy(buffer, bytesRead) < ENTROPY_THRESHOLD) return false;
+    }
+    return true;
+}
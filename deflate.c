@@ -1,4 +1,4 @@
-/* Copyright (c) 2020, 2023 Dennis Wölfing
+/* Copyright (c) 2020, 2023, 2026 Dennis Wölfing
  *
  * Permission to use, copy, modify, and/or distribute this software for any
  * purpose with or without fee is hereby granted, provided that the above
@@ -18,6 +18,7 @@
  */
 
 #include <config.h>
+#include <stdint.h>
 #include <string.h>
 #include "algorithm.h"
 
@@ -29,6 +30,7 @@ static int gzipCompress(int input, int output, int level,
         struct fileinfo* info);
 static int gzipDecompress(int input, int output, struct fileinfo* info,
         const unsigned char* buffer, size_t bufferSize);
+static void gzipFreeCache(void);
 static bool gzipProbe(const unsigned char* buffer, size_t bufferSize);
 
 const struct algorithm algoDeflate = {
@@ -39,7 +41,8 @@ const struct algorithm algoDeflate = {
     .maxLevel = 9,
     .compress = gzipCompress,
     .decompress = gzipDecompress,
-    .probe = gzipProbe
+    .probe = gzipProbe,
+    .freeCache = gzipFreeCache
 };
 
 #define MAGIC1 0x1F
@@ -50,14 +53,84 @@ static bool gzipProbe(const unsigned char* buffer, size_t bufferSize) {
     return bufferSize >= 6 && buffer[0] == MAGIC1 && buffer[1] == MAGIC2;
 }
 
+#if WITH_ZLIB
+// The streams are kept alive between files so that processing many files does
+// not need to allocate the compression state again for each file.
+static _Thread_local z_stream deflateStream;
+static _Thread_local bool deflateInitialized;
+static _Thread_local int deflateLevel;
+static _Thread_local z_stream inflateStream;
+static _Thread_local bool inflateInitialized;
+
+static voidpf zlibAlloc(voidpf opaque, uInt items, uInt size) {
+    if (size != 0 && items > SIZE_MAX / size) return Z_NULL;
+    return allocateMemory(opaque, (size_t) items * size);
+}
+
+static void zlibFree(voidpf opaque, voidpf address) {
+    (void) opaque;
+    freeMemory(address);
+}
+
+static int initDeflate(int level) {
+    if (deflateInitialized) {
+        if (level == deflateLevel && deflateReset(&deflateStream) == Z_OK) {
+            return Z_OK;
+        }
+        deflateEnd(&deflateStream);
+        deflateInitialized = false;
+    }
+
+    deflateStream.zalloc = zlibAlloc;
+    deflateStream.zfree = zlibFree;
+    deflateStream.opaque = getThreadAccount();
+    int status = deflateInit2(&deflateStream, level, Z_DEFLATED, 15 + 16, 8,
+            Z_DEFAULT_STRATEGY);
+    if (status == Z_OK) {
+        deflateInitialized = true;
+        deflateLevel = level;
+    }
+    return status;
+}
+
+static int initInflate(void) {
+    if (inflateInitialized) {
+        if (inflateReset(&inflateStream) == Z_OK) return Z_OK;
+        inflateEnd(&inflateStream);
+        inflateInitialized = false;
+    }
+
+    inflateStream.zalloc = zlibAlloc;
+    inflateStream.zfree = zlibFree;
+    inflateStream.opaque = getThreadAccount();
+    inflateStream.next_in = Z_NULL;
+    inflateStream.avail_in = 0;
+    int status = inflateInit2(&inflateStream, 15 + 16);
+    if (status == Z_OK) {
+        inflateInitialized = true;
+    }
+    return status;
+}
+#endif
+
+static void gzipFreeCache(void) {
+#if WITH_ZLIB
+    if (deflateInitialized) {
+        deflateEnd(&deflateStream);
+        deflateInitialized = false;
+    }
+    if (inflateInitialized) {
+        inflateEnd(&inflateStream);
+        inflateInitialized = false;
+    }
+#endif
+}
+
 static int gzipCompress(int input, int output, int level,
         struct fileinfo* info) {
 #if WITH_ZLIB
-    z_stream stream;
-    stream.zalloc = Z_NULL;
-    stream.zfree = Z_NULL;
-    int status = deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8,
-            Z_DEFAULT_STRATEGY);
+    z_stream* stream = &deflateStream;
+    int status = initDeflate(level);
     if (status == Z_MEM_ERROR) return RESULT_OUT_OF_MEMORY;
     if (status != Z_OK) return RESULT_UNKNOWN_ERROR;
 
@@ -75,52 +148,86 @@ static int gzipCompress(int input, int output, int level,
     header.name = (Bytef*) info->name;
     header.comment = Z_NULL;
     header.hcrc = 0;
-    deflateSetHeader(&stream, &header);
+    deflateSetHeader(stream, &header);
 
     unsigned char inputBuffer[BUFFER_SIZE];
     unsigned char outputBuffer[BUFFER_SIZE];
-    stream.next_out = outputBuffer;
-    stream.avail_in = 0;
-    stream.avail_out = sizeof(outputBuffer);
+    stream->next_out = outputBuffer;
+    stream->avail_in = 0;
+    stream->avail_out = sizeof(outputBuffer);
+
+    struct levelcontrol control;
+    initLevelControl(&control, level, algoDeflate.minLevel,
+            algoDeflate.maxLevel);
+    struct flushcontrol flush = {0};
 
     while (true) {
-        if (stream.avail_out == 0) {
+        if (stream->avail_out == 0) {
             if (writeAll(output, outputBuffer, sizeof(outputBuffer)) < 0) {
-                deflateEnd(&stream);
                 return RESULT_WRITE_ERROR;
             }
-            stream.next_out = outputBuffer;
-            stream.avail_out = sizeof(outputBuffer);
+            stream->next_out = outputBuffer;
+            stream->avail_out = sizeof(outputBuffer);
         }
 
-        if (stream.avail_in == 0) {
-            ssize_t bytesRead = read(input, inputBuffer, sizeof(inputBuffer));
-            if (bytesRead < 0) {
-                deflateEnd(&stream);
-                return RESULT_READ_ERROR;
+        if (stream->avail_in == 0) {
+            info->uncompressedSize = stream->total_in;
+            info->compressedSize = stream->total_out;
+            if (!reportProgress(info)) return RESULT_ABORTED;
+
+            int newLevel = adjustLevel(&control, stream->total_in);
+            if (newLevel != deflateLevel) {
+                // This fails if there is not enough space for the pending
+                // output. We then try again after the next read.
+                if (deflateParams(stream, newLevel, Z_DEFAULT_STRATEGY) ==
+                        Z_OK) {
+                    deflateLevel = newLevel;
+                } else {
+                    control.level = deflateLevel;
+                }
+                continue;
+            }
+
+            if (shouldFlush(input, &flush)) {
+                // Make all input so far available to the reader.
+                bool full;
+                do {
+                    deflate(stream, Z_SYNC_FLUSH);
+                    full = stream->avail_out == 0;
+                    if (writeAll(output, outputBuffer,
+                            sizeof(outputBuffer) - stream->avail_out) < 0) {
+                        return RESULT_WRITE_ERROR;
+                    }
+                    stream->next_out = outputBuffer;
+                    stream->avail_out = sizeof(outputBuffer);
+                } while (full);
             }
-            stream.next_in = inputBuffer;
-            stream.avail_in = bytesRead;
+
+            ssize_t bytesRead = readInput(input, inputBuffer,
+                    sizeof(inputBuffer));
+            if (bytesRead < 0) return RESULT_READ_ERROR;
+            PROBE2(block, "deflate", bytesRead);
+            stream->next_in = inputBuffer;
+            stream->avail_in = bytesRead;
+            addFlushInput(&flush, bytesRead);
             if (bytesRead == 0) break;
         }
 
-        deflate(&stream, Z_NO_FLUSH);
+        deflate(stream, Z_NO_FLUSH);
     }
 
     do {
-        status = deflate(&stream, Z_FINISH);
+        status = deflate(stream, Z_FINISH);
         if (writeAll(output, outputBuffer,
-                sizeof(outputBuffer) - stream.avail_out) < 0) {
-            deflateEnd(&stream);
+                sizeof(outputBuffer) - stream->avail_out) < 0) {
             return RESULT_WRITE_ERROR;
         }
-        stream.next_out = outputBuffer;
-        stream.avail_out = sizeof(outputBuffer);
+        stream->next_out = outputBuffer;
+        stream->avail_out = sizeof(outputBuffer);
     } while (status != Z_STREAM_END);
 
-    info->uncompressedSize = stream.total_in;
-    info->compressedSize = stream.total_out;
-    deflateEnd(&stream);
+    info->uncompressedSize = stream->total_in;
+    info->compressedSize = stream->total_out;
     return RESULT_OK;
 #else
     (void) input; (void) output; (void) level; (void) info;
@@ -133,18 +240,17 @@ static int gzipDecompress(int input, int output, struct fileinfo* info,
 #if WITH_ZLIB
     unsigned char inputBuffer[BUFFER_SIZE];
     memcpy(inputBuffer, buffer, bufferSize);
-    ssize_t bytesRead = read(input, inputBuffer + bufferSize,
+    ssize_t bytesRead = readInput(input, inputBuffer + bufferSize,
             sizeof(inputBuffer) - bufferSize);
     if (bytesRead < 0) return RESULT_READ_ERROR;
+    PROBE2(block, "deflate", bytesRead);
 
-    z_stream stream;
-    stream.zalloc = Z_NULL;
-    stream.zfree = Z_NULL;
-    stream.next_in = inputBuffer;
-    stream.avail_in = bufferSize + bytesRead;
-    int status = inflateInit2(&stream, 15 + 16);
+    z_stream* stream = &inflateStream;
+    int status = initInflate();
     if (status == Z_MEM_ERROR) return RESULT_OUT_OF_MEMORY;
     if (status != Z_OK) return RESULT_UNKNOWN_ERROR;
+    stream->next_in = inputBuffer;
+    stream->avail_in = bufferSize + bytesRead;
 
     gz_header header;
 #ifndef NAME_MAX
@@ -155,64 +261,68 @@ static int gzipDecompress(int input, int output, struct fileinfo* info,
     header.name_max = sizeof(name);
     header.extra = Z_NULL;
     header.comment = Z_NULL;
-    inflateGetHeader(&stream, &header);
+    inflateGetHeader(stream, &header);
 
     unsigned char outputBuffer[BUFFER_SIZE];
-    stream.next_out = outputBuffer;
-    stream.avail_out = sizeof(outputBuffer);
+    stream->next_out = outputBuffer;
+    stream->avail_out = sizeof(outputBuffer);
 
     bool endOfStream = false;
+    bool headerReported = false;
 
     info->compressedSize = bufferSize + bytesRead;
     info->uncompressedSize = 0;
 
     while (true) {
-        if (output == -2 && header.done == 1) {
-            output = openOutputFile((const char*) header.name, info->oinfo);
-            if (output < 0) {
-                inflateEnd(&stream);
-                return RESULT_OPEN_FAILURE;
+        if (!headerReported && header.done == 1) {
+            info->modificationTime.tv_sec = header.time;
+            info->modificationTime.tv_nsec = 0;
+            if (header.name) {
+                info->name = strndup((const char*) header.name,
+                        header.name_max);
+            }
+            reportHeader(info);
+            headerReported = true;
+            if (output == -2) {
+                output = openOutputFile((const char*) header.name,
+                        info->oinfo);
+                if (output < 0) return RESULT_OPEN_FAILURE;
             }
         }
 
-        if (stream.avail_out == 0 && output != -2) {
+        if (stream->avail_out == 0 && output != -2) {
             if (writeAll(output, outputBuffer, sizeof(outputBuffer)) < 0) {
-                inflateEnd(&stream);
                 return RESULT_WRITE_ERROR;
             }
             info->uncompressedSize += sizeof(outputBuffer);
-            stream.next_out = outputBuffer;
-            stream.avail_out = sizeof(outputBuffer);
+            if (!reportProgress(info)) return RESULT_ABORTED;
+            stream->next_out = outputBuffer;
+            stream->avail_out = sizeof(outputBuffer);
         }
 
-        if (stream.avail_in == 0) {
-            ssize_t bytesRead = read(input, inputBuffer, sizeof(inputBuffer));
-            if (bytesRead < 0) {
-                inflateEnd(&stream);
-                return RESULT_READ_ERROR;
-            }
+        if (stream->avail_in == 0) {
+            ssize_t bytesRead = readInput(input, inputBuffer,
+                    sizeof(inputBuffer));
+            if (bytesRead < 0) return RESULT_READ_ERROR;
+            PROBE2(block, "deflate", bytesRead);
             info->compressedSize += bytesRead;
-            stream.next_in = inputBuffer;
-            stream.avail_in = bytesRead;
+            stream->next_in = inputBuffer;
+            stream->avail_in = bytesRead;
         }
 
         if (endOfStream) {
-            if (stream.avail_in == 0) break;
+            if (stream->avail_in == 0) break;
             // Reset decompression to support concatenated gzipped files.
-            inflateReset(&stream);
+            inflateReset(stream);
             endOfStream = false;
         }
 
-        if (stream.avail_in == 0) {
-            inflateEnd(&stream);
-            return RESULT_FORMAT_ERROR;
-        }
+        if (stream->avail_in == 0) return RESULT_FORMAT_ERROR;
 
-        status = inflate(&stream, Z_NO_FLUSH);
+        status = inflate(stream, Z_NO_FLUSH);
         if (status == Z_STREAM_END) {
             endOfStream = true;
         } else if (status != Z_OK) {
-            inflateEnd(&stream);
             return status == Z_DATA_ERROR ? RESULT_FORMAT_ERROR :
                     status == Z_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
                     RESULT_UNKNOWN_ERROR;
@@ -220,18 +330,11 @@ static int gzipDecompress(int input, int output, struct fileinfo* info,
     }
 
     if (writeAll(output, outputBuffer,
-            sizeof(outputBuffer) - stream.avail_out) < 0) {
-        inflateEnd(&stream);
+            sizeof(outputBuffer) - stream->avail_out) < 0) {
         return RESULT_WRITE_ERROR;
     }
-    info->uncompressedSize += sizeof(outputBuffer) - stream.avail_out;
-    info->modificationTime.tv_sec = header.time;
-    info->modificationTime.tv_nsec = 0;
-    info->crc = stream.adler;
-    if (header.name) {
-        info->name = strndup((const char*) header.name, header.name_max);
-    }
-    inflateEnd(&stream);
+    info->uncompressedSize += sizeof(outputBuffer) - stream->avail_out;
+    info->crc = stream->adler;
 
     return RESULT_OK;
 #else
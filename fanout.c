@@ -0,0 +1,123 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* fanout.c
+ * Compression of the same input with multiple encoders in parallel.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "algorithm.h"
+
+#define BUFFER_SIZE (64 * 1024)
+
+static void* runEncoder(void* arg) {
+    struct encoder* encoder = arg;
+    encoder->result = encoder->algorithm->compress(encoder->input,
+            encoder->output, encoder->level, &encoder->info);
+
+    // Tell the reader that no more input is needed.
+    shutdown(encoder->input, SHUT_RD);
+    if (encoder->result == RESULT_OK && encoder->smallest) {
+        off_t size = encoder->info.compressedSize;
+        off_t smallest = atomic_load(encoder->smallest);
+        while ((smallest < 0 || size < smallest) &&
+                !atomic_compare_exchange_weak(encoder->smallest, &smallest,
+                size));
+    }
+    freeCaches();
+    return NULL;
+}
+
+static bool sendAll(int fd, const unsigned char* buffer, size_t size) {
+    while (size > 0) {
+        // Sockets are used instead of pipes because MSG_NOSIGNAL avoids
+        // SIGPIPE when an encoder stops reading early.
+        ssize_t sent = send(fd, buffer, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buffer += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+int compressFanout(int input, struct encoder* encoders, size_t count) {
+    pthread_t threads[count];
+    int sockets[count];
+    bool created[count];
+    bool running[count];
+
+    for (size_t i = 0; i < count; i++) {
+        created[i] = running[i] = false;
+        encoders[i].input = -1;
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+            encoders[i].result = RESULT_UNKNOWN_ERROR;
+            continue;
+        }
+        sockets[i] = fds[0];
+        encoders[i].input = fds[1];
+        if (pthread_create(&threads[i], NULL, runEncoder, &encoders[i]) != 0) {
+            close(fds[0]);
+            close(fds[1]);
+            encoders[i].input = -1;
+            encoders[i].result = RESULT_UNKNOWN_ERROR;
+            continue;
+        }
+        created[i] = running[i] = true;
+    }
+
+    int result = RESULT_OK;
+    unsigned char buffer[BUFFER_SIZE];
+    while (true) {
+        ssize_t bytesRead = readInput(input, buffer, sizeof(buffer));
+        if (bytesRead < 0) {
+            result = RESULT_READ_ERROR;
+            break;
+        }
+        if (bytesRead == 0) break;
+
+        bool anyRunning = false;
+        for (size_t i = 0; i < count; i++) {
+            if (!running[i]) continue;
+            if (!sendAll(sockets[i], buffer, bytesRead)) {
+                // The encoder has finished or given up.
+                close(sockets[i]);
+                running[i] = false;
+                continue;
+            }
+            anyRunning = true;
+        }
+        if (!anyRunning) break;
+    }
+
+    // Closing the sockets signals the end of the input to the encoders.
+    for (size_t i = 0; i < count; i++) {
+        if (running[i]) close(sockets[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!created[i]) continue;
+        pthread_join(threads[i], NULL);
+        close(encoders[i].input);
+        encoders[i].input = -1;
+    }
+    return result;
+}
@@ -0,0 +1,55 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* flush.c
+ * Decisions when to flush compressed output for streaming.
+ */
+
+#include <config.h>
+#include <poll.h>
+#include "algorithm.h"
+
+void addFlushInput(struct flushcontrol* control, size_t size) {
+    if (size == 0) return;
+    if (control->pending == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &control->pendingSince);
+    }
+    control->pending += size;
+}
+
+bool shouldFlush(int input, struct flushcontrol* control) {
+    if (control->pending == 0) return false;
+
+    bool flush = flushBytes && control->pending >= flushBytes;
+    if (!flush && flushInterval) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long elapsed = (now.tv_sec - control->pendingSince.tv_sec) *
+                1000LL + (now.tv_nsec - control->pendingSince.tv_nsec) /
+                1000000;
+
+        // Wait for more input until the oldest pending data is due. Data that
+        // is already due is flushed even if more input is available.
+        if (elapsed >= (long long) flushInterval) {
+            flush = true;
+        } else {
+            struct pollfd pfd = { .fd = input, .events = POLLIN };
+            flush = poll(&pfd, 1, flushInterval - elapsed) == 0;
+        }
+    }
+
+    if (flush) control->pending = 0;
+    return flush;
+}
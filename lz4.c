@@ -0,0 +1,491 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* lz4.c
+ * LZ4 compression.
+ */
+
+#include <config.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "algorithm.h"
+
+#if WITH_LIBLZ4
+#  include <lz4.h>
+#  include <lz4frame.h>
+#  include <lz4hc.h>
+#endif
+
+static int lz4Compress(int input, int output, int level,
+        struct fileinfo* info);
+static int lz4Decompress(int input, int output, struct fileinfo* info,
+        const unsigned char* buffer, size_t bufferSize);
+static void lz4FreeCache(void);
+static bool lz4Probe(const unsigned char* buffer, size_t bufferSize);
+
+const struct algorithm algoLz4 = {
+    .names = "lz4",
+    .extensions = "lz4,tlz4:tar",
+    .minLevel = 1,
+    .defaultLevel = 1,
+    .maxLevel = 12,
+    .compress = lz4Compress,
+    .decompress = lz4Decompress,
+    .probe = lz4Probe,
+    .freeCache = lz4FreeCache
+};
+
+#define BUFFER_SIZE (4096 * 8)
+#define LZ4MAGIC "\x04\x22\x4D\x18"
+// Levels below this use the fast compressor, higher levels use LZ4HC. Like with
+// lz4(1) levels 1 and 2 are therefore equivalent.
+#define MIN_HC_LEVEL 3
+// LZ4 cannot compress data to less than about 1/255 of its size. A larger
+// content size in the frame header cannot be correct.
+#define MAX_RATIO 255
+
+static bool lz4Probe(const unsigned char* buffer, size_t bufferSize) {
+    return bufferSize >= 4 && memcmp(buffer, LZ4MAGIC, 4) == 0;
+}
+
+#if WITH_LIBLZ4
+// We write the frame ourselves so that blocks can be compressed in parallel.
+// The frame uses 4 MiB independent blocks and a content checksum.
+#define BLOCK_SIZE (4 * 1024 * 1024)
+#define BLOCK_SIZE_ID 7
+#define FLG_VERSION (1 << 6)
+#define FLG_BLOCK_INDEPENDENT (1 << 5)
+#define FLG_CONTENT_SIZE (1 << 3)
+#define FLG_CONTENT_CHECKSUM (1 << 2)
+#define UNCOMPRESSED_BLOCK 0x80000000U
+
+// XXH32 as used for the header and content checksums of the frame format.
+#define PRIME1 2654435761U
+#define PRIME2 2246822519U
+#define PRIME3 3266489917U
+#define PRIME4 668265263U
+#define PRIME5 374761393U
+
+struct xxh32 {
+    uint32_t v[4];
+    uint64_t totalSize;
+    unsigned char buffer[16];
+    size_t bufferUsed;
+};
+
+struct block {
+    unsigned char* input;
+    unsigned char* output;
+    void* state;
+    size_t inputSize;
+    size_t outputSize;
+    int level;
+};
+
+static _Thread_local struct block* blocks;
+static _Thread_local size_t numBlocks;
+static _Thread_local LZ4F_dctx* decompressContext;
+
+static uint32_t rotateLeft(uint32_t value, int bits) {
+    return value << bits | value >> (32 - bits);
+}
+
+static uint32_t read32(const unsigned char* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void write32(unsigned char* p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t xxhRound(uint32_t acc, uint32_t input) {
+    return rotateLeft(acc + input * PRIME2, 13) * PRIME1;
+}
+
+static void xxhInit(struct xxh32* state) {
+    state->v[0] = PRIME1 + PRIME2;
+    state->v[1] = PRIME2;
+    state->v[2] = 0;
+    state->v[3] = -PRIME1;
+    state->totalSize = 0;
+    state->bufferUsed = 0;
+}
+
+static void xxhStripe(struct xxh32* state, const unsigned char* p) {
+    for (int i = 0; i < 4; i++) {
+        state->v[i] = xxhRound(state->v[i], read32(p + 4 * i));
+    }
+}
+
+static void xxhUpdate(struct xxh32* state, const unsigned char* data,
+        size_t size) {
+    state->totalSize += size;
+    if (state->bufferUsed + size < 16) {
+        memcpy(state->buffer + state->bufferUsed, data, size);
+        state->bufferUsed += size;
+        return;
+    }
+
+    if (state->bufferUsed) {
+        size_t missing = 16 - state->bufferUsed;
+        memcpy(state->buffer + state->bufferUsed, data, missing);
+        xxhStripe(state, state->buffer);
+        data += missing;
+        size -= missing;
+        state->bufferUsed = 0;
+    }
+
+    while (size >= 16) {
+        xxhStripe(state, data);
+        data += 16;
+        size -= 16;
+    }
+    memcpy(state->buffer, data, size);
+    state->bufferUsed = size;
+}
+
+static uint32_t xxhDigest(const struct xxh32* state) {
+    uint32_t hash;
+    if (state->totalSize >= 16) {
+        hash = rotateLeft(state->v[0], 1) + rotateLeft(state->v[1], 7) +
+                rotateLeft(state->v[2], 12) + rotateLeft(state->v[3], 18);
+    } else {
+        hash = state->v[2] + PRIME5;
+    }
+    hash += (uint32_t) state->totalSize;
+
+    const unsigned char* p = state->buffer;
+    const unsigned char* end = p + state->bufferUsed;
+    for (; p + 4 <= end; p += 4) {
+        hash = rotateLeft(hash + read32(p) * PRIME3, 17) * PRIME4;
+    }
+    for (; p < end; p++) {
+        hash = rotateLeft(hash + *p * PRIME5, 11) * PRIME1;
+    }
+
+    hash ^= hash >> 15;
+    hash *= PRIME2;
+    hash ^= hash >> 13;
+    hash *= PRIME3;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static void freeBlocks(void) {
+    for (size_t i = 0; i < numBlocks; i++) {
+        freeMemory(blocks[i].input);
+        freeMemory(blocks[i].output);
+        freeMemory(blocks[i].state);
+    }
+    freeMemory(blocks);
+    blocks = NULL;
+    numBlocks = 0;
+}
+
+static bool allocateBlocks(size_t count) {
+    if (numBlocks >= count) return true;
+    freeBlocks();
+
+    struct memaccount* account = getThreadAccount();
+    blocks = allocateMemory(account, count * sizeof(struct block));
+    if (!blocks) return false;
+    memset(blocks, 0, count * sizeof(struct block));
+    numBlocks = count;
+
+    size_t stateSize = LZ4_sizeofStateHC();
+    if ((size_t) LZ4_sizeofState() > stateSize) stateSize = LZ4_sizeofState();
+    for (size_t i = 0; i < count; i++) {
+        blocks[i].input = allocateMemory(account, BLOCK_SIZE);
+        blocks[i].output = allocateMemory(account, BLOCK_SIZE);
+        blocks[i].state = allocateMemory(account, stateSize);
+        if (!blocks[i].input || !blocks[i].output || !blocks[i].state) {
+            freeBlocks();
+            return false;
+        }
+    }
+    return true;
+}
+
+static void* compressBlock(void* arg) {
+    struct block* block = arg;
+    PROBE2(block, "lz4", block->inputSize);
+    int size;
+    // Blocks that do not become smaller are stored uncompressed.
+    if (block->level < MIN_HC_LEVEL) {
+        size = LZ4_compress_fast_extState(block->state,
+                (const char*) block->input, (char*) block->output,
+                block->inputSize, block->inputSize - 1, 1);
+    } else {
+        size = LZ4_compress_HC_extStateHC(block->state,
+                (const char*) block->input, (char*) block->output,
+                block->inputSize, block->inputSize - 1, block->level);
+    }
+    block->outputSize = size > 0 ? (size_t) size : 0;
+    return NULL;
+}
+
+static ssize_t readBlock(int input, unsigned char* buffer) {
+    size_t bytesRead = 0;
+    while (bytesRead < BLOCK_SIZE) {
+        ssize_t result = readInput(input, buffer + bytesRead,
+                BLOCK_SIZE - bytesRead);
+        if (result < 0) return -1;
+        if (result == 0) break;
+        bytesRead += result;
+    }
+    return bytesRead;
+}
+
+// Creates the frame header with the content size, unless it is negative, and
+// returns its size.
+static size_t createHeader(unsigned char* header, off_t contentSize) {
+    size_t headerSize = 6;
+    memcpy(header, LZ4MAGIC, 4);
+    header[4] = FLG_VERSION | FLG_BLOCK_INDEPENDENT | FLG_CONTENT_CHECKSUM;
+    header[5] = BLOCK_SIZE_ID << 4;
+    if (contentSize >= 0) {
+        header[4] |= FLG_CONTENT_SIZE;
+        uint64_t size = contentSize;
+        write32(header + 6, size);
+        write32(header + 10, size >> 32);
+        headerSize += 8;
+    }
+
+    struct xxh32 state;
+    xxhInit(&state);
+    xxhUpdate(&state, header + 4, headerSize - 4);
+    header[headerSize++] = xxhDigest(&state) >> 8;
+    return headerSize;
+}
+
+// Writes the frame header and returns its size. The content size is stored in
+// *contentSize and *headerOffset is set to the position of the header in the
+// output, or both are set to -1 if the header has no content size.
+static int writeHeader(int output, int input, off_t* contentSize,
+        off_t* headerOffset) {
+    // Store the content size so that the decompressor can preallocate the
+    // output file. This is only done when the whole input is compressed and
+    // the header can be corrected in case the file changes its size. pwrite
+    // cannot correct it when the output was opened with O_APPEND.
+    struct stat st;
+    *contentSize = -1;
+    *headerOffset = -1;
+    int flags = fcntl(output, F_GETFL);
+    if (fstat(input, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+            lseek(input, 0, SEEK_CUR) == 0 && flags >= 0 &&
+            !(flags & O_APPEND)) {
+        *headerOffset = lseek(output, 0, SEEK_CUR);
+        if (*headerOffset >= 0) *contentSize = st.st_size;
+    }
+
+    unsigned char header[15];
+    size_t headerSize = createHeader(header, *contentSize);
+    return writeAll(output, header, headerSize) < 0 ? -1 : (int) headerSize;
+}
+#endif
+
+static void lz4FreeCache(void) {
+#if WITH_LIBLZ4
+    freeBlocks();
+    LZ4F_freeDecompressionContext(decompressContext);
+    decompressContext = NULL;
+#endif
+}
+
+static int lz4Compress(int input, int output, int level,
+        struct fileinfo* info) {
+#if WITH_LIBLZ4
+    // Each thread needs an input and an output buffer.
+    size_t threads = getThreadCount(2 * BLOCK_SIZE);
+    if (!allocateBlocks(threads)) return RESULT_OUT_OF_MEMORY;
+
+    off_t contentSize;
+    off_t headerOffset;
+    int headerSize = writeHeader(output, input, &contentSize, &headerOffset);
+    if (headerSize < 0) return RESULT_WRITE_ERROR;
+    info->uncompressedSize = 0;
+    info->compressedSize = headerSize;
+
+    struct xxh32 checksum;
+    xxhInit(&checksum);
+    bool endOfFile = false;
+
+    while (!endOfFile) {
+        if (!reportProgress(info)) return RESULT_ABORTED;
+
+        size_t count = 0;
+        while (count < threads) {
+            ssize_t bytesRead = readBlock(input, blocks[count].input);
+            if (bytesRead < 0) return RESULT_READ_ERROR;
+            if (bytesRead < BLOCK_SIZE) endOfFile = true;
+            if (bytesRead == 0) break;
+            blocks[count].inputSize = bytesRead;
+            blocks[count].level = level;
+            xxhUpdate(&checksum, blocks[count].input, bytesRead);
+            count++;
+            if (endOfFile) break;
+        }
+        if (count == 0) break;
+        if ((int) count > info->threads) info->threads = count;
+
+        runParallel(compressBlock, blocks, sizeof(struct block), count);
+
+        for (size_t i = 0; i < count; i++) {
+            struct block* block = &blocks[i];
+            unsigned char blockHeader[4];
+            const unsigned char* data = block->output;
+            size_t size = block->outputSize;
+            if (size == 0) {
+                data = block->input;
+                size = block->inputSize;
+                write32(blockHeader, size | UNCOMPRESSED_BLOCK);
+            } else {
+                write32(blockHeader, size);
+            }
+
+            if (writeAll(output, blockHeader, 4) < 0 ||
+                    writeAll(output, data, size) < 0) {
+                return RESULT_WRITE_ERROR;
+            }
+            info->uncompressedSize += block->inputSize;
+            info->compressedSize += 4 + size;
+        }
+    }
+
+    unsigned char trailer[8];
+    write32(trailer, 0);
+    write32(trailer + 4, xxhDigest(&checksum));
+    if (writeAll(output, trailer, sizeof(trailer)) < 0) {
+        return RESULT_WRITE_ERROR;
+    }
+    info->compressedSize += sizeof(trailer);
+
+    if (contentSize >= 0 && contentSize != info->uncompressedSize) {
+        // The file changed its size while it was compressed.
+        unsigned char header[15];
+        createHeader(header, info->uncompressedSize);
+        if (pwrite(output, header, headerSize, headerOffset) != headerSize) {
+            return RESULT_WRITE_ERROR;
+        }
+    }
+    return RESULT_OK;
+#else
+    (void) input; (void) output; (void) level; (void) info;
+    return RESULT_UNIMPLEMENTED_FORMAT;
+#endif
+}
+
+static int lz4Decompress(int input, int output, struct fileinfo* info,
+        const unsigned char* buffer, size_t bufferSize) {
+#if WITH_LIBLZ4
+    reportHeader(info);
+    if (output == -2) {
+        output = openOutputFile(NULL, info->oinfo);
+        if (output < 0) return RESULT_OPEN_FAILURE;
+    }
+
+    if (!decompressContext) {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&decompressContext,
+                LZ4F_VERSION))) {
+            decompressContext = NULL;
+            return RESULT_OUT_OF_MEMORY;
+        }
+    } else {
+        LZ4F_resetDecompressionContext(decompressContext);
+    }
+    LZ4F_dctx* context = decompressContext;
+
+    unsigned char inputBuffer[BUFFER_SIZE];
+    unsigned char outputBuffer[BUFFER_SIZE];
+    memcpy(inputBuffer, buffer, bufferSize);
+    ssize_t bytesRead = readInput(input, inputBuffer + bufferSize,
+            sizeof(inputBuffer) - bufferSize);
+    if (bytesRead < 0) return RESULT_READ_ERROR;
+    PROBE2(block, "lz4", bytesRead);
+    size_t inputSize = bufferSize + bytesRead;
+    size_t inputPos = 0;
+    off_t totalIn = inputSize;
+    off_t totalOut = 0;
+
+#if HAVE_POSIX_FALLOCATE
+    // Preallocate the output file when the frame header contains the size.
+    // The header is not verified yet, so the size must be plausible for the
+    // size of the input.
+    LZ4F_frameInfo_t frameInfo;
+    size_t headerSize = inputSize;
+    struct stat inputStat;
+    if (output > 1 && !LZ4F_isError(LZ4F_getFrameInfo(context, &frameInfo,
+            inputBuffer, &headerSize))) {
+        inputPos = headerSize;
+        if (frameInfo.contentSize > 0 && fstat(input, &inputStat) == 0 &&
+                S_ISREG(inputStat.st_mode) && inputStat.st_size > 0 &&
+                frameInfo.contentSize / MAX_RATIO <=
+                (uint64_t) inputStat.st_size &&
+                frameInfo.contentSize <= (uint64_t) INTMAX_MAX) {
+            posix_fallocate(output, 0, frameInfo.contentSize);
+        }
+    }
+#endif
+
+    size_t hint = 1;
+    bool outputFull = false;
+    while (true) {
+        if (inputPos == inputSize && !outputFull) {
+            info->compressedSize = totalIn;
+            info->uncompressedSize = totalOut;
+            if (!reportProgress(info)) return RESULT_ABORTED;
+
+            bytesRead = readInput(input, inputBuffer, sizeof(inputBuffer));
+            if (bytesRead < 0) return RESULT_READ_ERROR;
+            PROBE2(block, "lz4", bytesRead);
+            if (bytesRead == 0) break;
+            inputSize = bytesRead;
+            inputPos = 0;
+            totalIn += bytesRead;
+        }
+
+        // Concatenated frames are decompressed as a single stream.
+        size_t srcSize = inputSize - inputPos;
+        size_t dstSize = sizeof(outputBuffer);
+        hint = LZ4F_decompress(context, outputBuffer, &dstSize,
+                inputBuffer + inputPos, &srcSize, NULL);
+        if (LZ4F_isError(hint)) return RESULT_FORMAT_ERROR;
+        inputPos += srcSize;
+        outputFull = dstSize == sizeof(outputBuffer);
+
+        if (writeAll(output, outputBuffer, dstSize) < 0) {
+            return RESULT_WRITE_ERROR;
+        }
+        totalOut += dstSize;
+    }
+
+    // The input ended within a frame.
+    if (hint != 0) return RESULT_FORMAT_ERROR;
+
+    info->compressedSize = totalIn;
+    info->uncompressedSize = totalOut;
+    info->crc = -1;
+    return RESULT_OK;
+#else
+    (void) input; (void) output; (void) info; (void) buffer; (void) bufferSize;
+    return RESULT_UNIMPLEMENTED_FORMAT;
+#endif
+}
@@ -1,4 +1,4 @@
-/* Copyright (c) 2020 Dennis Wölfing
+/* Copyright (c) 2020, 2026 Dennis Wölfing
  *
  * Permission to use, copy, modify, and/or distribute this software for any
  * purpose with or without fee is hereby granted, provided that the above
@@ -76,6 +76,7 @@ static int lzwCompress(int input, int output, int maxbits,
         struct fileinfo* info);
 static int lzwDecompress(int input, int output, struct fileinfo* info,
         const unsigned char* buffer, size_t bufferSize);
+static void lzwFreeCache(void);
 static bool lzwProbe(const unsigned char* buffer, size_t bufferSize);
 
 const struct algorithm algoLzw = {
@@ -86,7 +87,8 @@ const struct algorithm algoLzw = {
     .maxLevel = 16,
     .compress = lzwCompress,
     .decompress = lzwDecompress,
-    .probe = lzwProbe
+    .probe = lzwProbe,
+    .freeCache = lzwFreeCache
 };
 
 #define MAGIC1 0x1F
@@ -109,6 +111,8 @@ struct state {
     off_t bytesInGroup;
     size_t bufferOffset;
     size_t inputSize; // for decompress only
+    struct fileinfo* info; // for decompress only
+    bool aborted; // for decompress only
     unsigned char currentBits;
     unsigned char bitOffset;
     unsigned char buffer[BUFFER_SIZE];
@@ -138,6 +142,12 @@ static inline size_t hash2(uint16_t prev, unsigned char c) {
     return HASHDICT_SIZE - 1 - (prev ^ c << 8);
 }
 
+// The dictionaries are kept allocated between files so that they do not need
+// to be allocated again for each file. Because they are accessed randomly they
+// are allocated using huge pages if possible.
+static _Thread_local struct HashDict* compressDict;
+static _Thread_local struct dict* decompressDict;
+
 static size_t findIndex(struct HashDict* dict, uint16_t prev, unsigned char c) {
     size_t index = hash1(prev, c);
     while (dict[index].code != 0) {
@@ -166,8 +176,9 @@ static int lzwCompress(int input, int output, int maxbits,
     state.bufferOffset = 3;
 
     unsigned char inputBuffer[BUFFER_SIZE];
-    ssize_t amount = read(input, inputBuffer, BUFFER_SIZE);
+    ssize_t amount = readInput(input, inputBuffer, BUFFER_SIZE);
     if (amount < 0) return RESULT_READ_ERROR;
+    PROBE2(block, "lzw", amount);
     if (amount == 0) {
         if (writeAll(output, state.buffer, state.bufferOffset) < 0) {
             return RESULT_WRITE_ERROR;
@@ -176,27 +187,75 @@ static int lzwCompress(int input, int output, int maxbits,
     }
     size_t inputSize = amount;
 
-    struct HashDict* dict = calloc(HASHDICT_SIZE, sizeof(struct HashDict));
-    if (!dict) return RESULT_OUT_OF_MEMORY;
+    if (!compressDict) {
+        compressDict = allocateLargeMemory(getThreadAccount(),
+                HASHDICT_SIZE * sizeof(struct HashDict));
+        if (!compressDict) return RESULT_OUT_OF_MEMORY;
+    }
+    struct HashDict* dict = compressDict;
+    memset(dict, 0, HASHDICT_SIZE * sizeof(struct HashDict));
 
     size_t dictEntries = 1 << maxbits;
     size_t nextFree = DICT_OFFSET;
     uint16_t currentSeq = inputBuffer[0];
     size_t inputOffset = 1;
+    // After a flush the next byte starts a new sequence.
+    bool needSequence = false;
+    struct flushcontrol flush = {0};
+    addFlushInput(&flush, inputSize);
 
     while (true) {
         if (inputOffset >= inputSize) {
-            amount = read(input, inputBuffer, BUFFER_SIZE);
-            if (amount < 0) {
-                free(dict);
-                return RESULT_READ_ERROR;
+            info->uncompressedSize = state.inputBytes;
+            info->compressedSize = state.outputBytes;
+            if (!reportProgress(info)) return RESULT_ABORTED;
+
+            if (!needSequence && shouldFlush(input, &flush)) {
+                // Codes can only be padded to a group boundary when the bit
+                // size changes, so the dictionary is cleared to flush.
+                if (!writeCode(output, currentSeq, &state)) goto writeError;
+
+                // The decompressor adds a dictionary entry for every code, so
+                // the bit size must change as if an entry was added here.
+                if (nextFree == 512 && maxbits == 9 && state.currentBits == 9) {
+                    if (!writePadding(output, &state)) goto writeError;
+                    state.currentBits = 10;
+                }
+                if (nextFree < dictEntries &&
+                        (nextFree & (nextFree - 1)) == 0) {
+                    if (!writePadding(output, &state)) goto writeError;
+                    state.currentBits++;
+                }
+                if (!writeCode(output, CLEAR_CODE, &state) ||
+                        !writePadding(output, &state)) {
+                    goto writeError;
+                }
+                if (writeAll(output, state.buffer, state.bufferOffset) < 0) {
+                    goto writeError;
+                }
+                state.bufferOffset = 0;
+                PROBE1(lzw__clear, nextFree);
+                memset(dict, 0, HASHDICT_SIZE * sizeof(struct HashDict));
+                nextFree = DICT_OFFSET;
+                state.currentBits = 9;
+                needSequence = true;
             }
+
+            amount = readInput(input, inputBuffer, BUFFER_SIZE);
+            if (amount < 0) return RESULT_READ_ERROR;
+            PROBE2(block, "lzw", amount);
             if (amount == 0) break;
             inputOffset = 0;
             inputSize = amount;
+            addFlushInput(&flush, amount);
         }
         unsigned char c = inputBuffer[inputOffset++];
         state.inputBytes++;
+        if (needSequence) {
+            currentSeq = c;
+            needSequence = false;
+            continue;
+        }
 
         size_t index = findIndex(dict, currentSeq, c);
         if (dict[index].code != 0) {
@@ -221,6 +280,7 @@ static int lzwCompress(int input, int output, int maxbits,
                         !writePadding(output, &state)) {
                     goto writeError;
                 }
+                PROBE1(lzw__clear, nextFree);
                 memset(dict, 0, HASHDICT_SIZE * sizeof(struct HashDict));
                 nextFree = DICT_OFFSET;
                 state.currentBits = 9;
@@ -228,9 +288,10 @@ static int lzwCompress(int input, int output, int maxbits,
             currentSeq = c;
         }
     }
-    free(dict);
 
-    if (!writeCode(output, currentSeq, &state)) return RESULT_WRITE_ERROR;
+    if (!needSequence && !writeCode(output, currentSeq, &state)) {
+        return RESULT_WRITE_ERROR;
+    }
     if (state.bitOffset) {
         state.outputBytes++;
         state.bufferOffset++;
@@ -244,7 +305,6 @@ static int lzwCompress(int input, int output, int maxbits,
     return RESULT_OK;
 
 writeError:
-    free(dict);
     return RESULT_WRITE_ERROR;
 }
 
@@ -317,6 +377,28 @@ struct dict {
     unsigned char buffer;
 };
 
+// Stores the bytes of the sequence of code except for the first one in reverse
+// order in the buffer fields of the dictionary and returns the first byte.
+static inline uint16_t walkChain(struct dict* dict, uint16_t code,
+        size_t dictOffset, size_t* length) {
+    size_t codeLength = 0;
+    while (code > 0xFF) {
+        // This cannot overflow because each code can only use codes already in
+        // the dictionary and cycles are not allowed.
+        dict[codeLength++].buffer = dict[code - dictOffset].c;
+        code = dict[code - dictOffset].prev;
+    }
+    *length = codeLength;
+    return code;
+}
+
+static void lzwFreeCache(void) {
+    freeMemory(compressDict);
+    compressDict = NULL;
+    freeMemory(decompressDict);
+    decompressDict = NULL;
+}
+
 static int readBuffer(int input, struct state* state);
 static int readCode(int input, uint16_t* code, struct state* state);
 static int discardPadding(int input, struct state* state);
@@ -330,12 +412,14 @@ static int lzwDecompress(int input, int output, struct fileinfo* info,
     state.bufferOffset = 3;
     state.currentBits = 9;
     state.bitOffset = 0;
+    state.info = info;
+    state.aborted = false;
 
     memcpy(state.buffer, buffer, bufferSize);
     state.inputSize = bufferSize;
 
     while (state.inputSize < 3) {
-        ssize_t amount = read(input, state.buffer,
+        ssize_t amount = readInput(input, state.buffer,
                 BUFFER_SIZE - state.inputSize);
         if (amount < 0) return RESULT_READ_ERROR;
         if (amount == 0) return RESULT_FORMAT_ERROR;
@@ -352,6 +436,7 @@ static int lzwDecompress(int input, int output, struct fileinfo* info,
     size_t dictEntries = 1 << maxbits;
     size_t dictOffset = blockCompress ? DICT_OFFSET : DICT_OFFSET - 1;
 
+    reportHeader(info);
     if (output == -2) {
         output = openOutputFile(NULL, info->oinfo);
         if (output < 0) return RESULT_OPEN_FAILURE;
@@ -362,15 +447,20 @@ static int lzwDecompress(int input, int output, struct fileinfo* info,
     size_t outputOffset = 0;
     uint16_t previousSeq;
     int readStatus = readCode(input, &previousSeq, &state);
-    if (readStatus == -1) return RESULT_READ_ERROR;
+    if (readStatus == -1) goto readError;
     if (readStatus == 0) return RESULT_OK;
     if (previousSeq >= nextFree) return RESULT_FORMAT_ERROR;
     outputBuffer[outputOffset++] = previousSeq;
     state.outputBytes++;
 
-    struct dict* dict = malloc((dictEntries - dictOffset) *
-            sizeof(struct dict));
-    if (!dict) return RESULT_OUT_OF_MEMORY;
+    if (!decompressDict) {
+        // Allocate the dictionary for the maximum number of bits so that it
+        // can be reused for any file.
+        decompressDict = allocateLargeMemory(getThreadAccount(),
+                ((1 << 16) - (DICT_OFFSET - 1)) * sizeof(struct dict));
+        if (!decompressDict) return RESULT_OUT_OF_MEMORY;
+    }
+    struct dict* dict = decompressDict;
 
     while (true) {
         uint16_t code;
@@ -382,6 +472,7 @@ static int lzwDecompress(int input, int output, struct fileinfo* info,
             readStatus = discardPadding(input, &state);
             if (readStatus == -1) goto readError;
             if (readStatus == 0) goto formatError;
+            PROBE1(lzw__clear, nextFree);
             nextFree = dictOffset;
             state.currentBits = 9;
             readStatus = readCode(input, &previousSeq, &state);
@@ -400,13 +491,8 @@ static int lzwDecompress(int input, int output, struct fileinfo* info,
             uint16_t originalCode = code;
             if (code == nextFree) code = previousSeq;
 
-            size_t codeLength = 0;
-            while (code > 0xFF) {
-                // This cannot overflow because each code can only use codes
-                // already in the dictionary and cycles are not allowed.
-                dict[codeLength++].buffer = dict[code - dictOffset].c;
-                code = dict[code - dictOffset].prev;
-            }
+            size_t codeLength;
+            code = walkChain(dict, code, dictOffset, &codeLength);
             outputBuffer[outputOffset++] = code;
             state.outputBytes++;
             if (outputOffset >= BUFFER_SIZE) {
@@ -453,7 +539,6 @@ static int lzwDecompress(int input, int output, struct fileinfo* info,
             previousSeq = originalCode;
         }
     }
-    free(dict);
     if (writeAll(output, outputBuffer, outputOffset) < 0) {
         return RESULT_WRITE_ERROR;
     }
@@ -464,20 +549,26 @@ static int lzwDecompress(int input, int output, struct fileinfo* info,
     return RESULT_OK;
 
 formatError:
-    free(dict);
     return RESULT_FORMAT_ERROR;
 readError:
-    free(dict);
-    return RESULT_READ_ERROR;
+    return state.aborted ? RESULT_ABORTED : RESULT_READ_ERROR;
 writeError:
-    free(dict);
     return RESULT_WRITE_ERROR;
 }
 
 static int readBuffer(int input, struct state* state) {
     if (state->bufferOffset >= state->inputSize) {
-        ssize_t amount = read(input, state->buffer, BUFFER_SIZE);
+        // Progress is reported after each buffer of input.
+        state->info->compressedSize = state->inputBytes;
+        state->info->uncompressedSize = state->outputBytes;
+        if (!reportProgress(state->info)) {
+            state->aborted = true;
+            return -1;
+        }
+
+        ssize_t amount = readInput(input, state->buffer, BUFFER_SIZE);
         if (amount < 0) return -1;
+        PROBE2(block, "lzw", amount);
         state->bufferOffset = 0;
         state->inputSize = amount;
         if (amount == 0) return 0;
@@ -527,7 +618,8 @@ static int discardPadding(int input, struct state* state) {
     size_t padding = state->currentBits - misalignment;
     state->inputBytes += padding;
     state->bufferOffset += padding;
-    while (state->bufferOffset >= state->inputSize) {
+    // The input may end right after the padding when the output was flushed.
+    while (state->bufferOffset > state->inputSize) {
         size_t remaining = state->bufferOffset - state->inputSize;
         int readStatus = readBuffer(input, state);
         if (readStatus != 1) return readStatus;
@@ -0,0 +1,338 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* lzwbench.c
+ * Microbenchmarks for the LZW dictionary and bit I/O. This is not installed.
+ */
+
+// The kernels are static, so the implementation is included directly.
+#include "lzw.c"
+
+#include <stdio.h>
+#include <time.h>
+#if HAVE_LINUX_PERF_EVENT_H
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
+
+#define REPETITIONS 3
+#define OPERATIONS (1 << 22)
+#define WALK_OPERATIONS (1 << 20)
+
+// Definitions of what lzw.c uses from main.c and stats.c. Nothing is written
+// because all output goes to the null sink.
+uint64_t flushBytes = 0;
+unsigned long flushInterval = 0;
+
+int openOutputFile(const char* outputName, struct outputinfo* oinfo) {
+    (void) outputName; (void) oinfo;
+    return -1;
+}
+
+ssize_t readInput(int fd, void* buffer, size_t size) {
+    return read(fd, buffer, size);
+}
+
+void reportHeader(struct fileinfo* info) {
+    (void) info;
+}
+
+bool reportProgress(struct fileinfo* info) {
+    (void) info;
+    return true;
+}
+
+ssize_t writeAll(int fd, const void* buffer, size_t size) {
+    (void) fd; (void) buffer;
+    return size;
+}
+
+// Fixed sequence so that every run uses the same dictionaries and codes.
+static uint32_t randomState = 2463534242;
+
+static uint32_t nextRandom(void) {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+// Results of the kernels are accumulated here so that they are not optimized
+// away.
+static volatile uint64_t sink;
+
+static struct HashDict* hashDict;
+static uint16_t* lookupPrev;
+static unsigned char* lookupChar;
+static size_t numLookups;
+static unsigned int codeBits;
+static struct state state;
+static struct dict* chainDict;
+static uint16_t* walkCodes;
+
+static int openCounter(void) {
+#if HAVE_LINUX_PERF_EVENT_H
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void startCounter(int counter) {
+#if HAVE_LINUX_PERF_EVENT_H
+    if (counter < 0) return;
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+#else
+    (void) counter;
+#endif
+}
+
+static long long stopCounter(int counter) {
+#if HAVE_LINUX_PERF_EVENT_H
+    long long count;
+    if (counter < 0) return -1;
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter, &count, sizeof(count)) != sizeof(count)) return -1;
+    return count;
+#else
+    (void) counter;
+    return -1;
+#endif
+}
+
+static double getTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void run(const char* name, void (*kernel)(size_t), size_t operations,
+        int counter) {
+    double best = 0;
+    long long misses = -1;
+    for (int i = 0; i < REPETITIONS; i++) {
+        startCounter(counter);
+        double start = getTime();
+        kernel(operations);
+        double time = getTime() - start;
+        long long count = stopCounter(counter);
+        if (i == 0 || time < best) {
+            best = time;
+            misses = count;
+        }
+    }
+
+    printf("%-28s %10.2f", name, best * 1e9 / operations);
+    if (misses >= 0) {
+        printf(" %14.4f\n", (double) misses / operations);
+    } else {
+        printf(" %14s\n", "n/a");
+    }
+}
+
+// Fills the hash dictionary like the compressor does for a dictionary with
+// the given number of bits. Entries extend random earlier codes by bytes of a
+// small alphabet, like text.
+static void fillHashDict(unsigned int bits) {
+    memset(hashDict, 0, HASHDICT_SIZE * sizeof(struct HashDict));
+    size_t entries = (1 << bits) - DICT_OFFSET;
+    numLookups = 0;
+    for (size_t code = DICT_OFFSET; numLookups < entries; code++) {
+        uint16_t prev = nextRandom() % code;
+        if (prev == CLEAR_CODE) continue;
+        unsigned char c = 'a' + nextRandom() % 26;
+        size_t index = findIndex(hashDict, prev, c);
+        if (hashDict[index].code != 0) continue;
+        hashDict[index].code = DICT_OFFSET + numLookups;
+        hashDict[index].prev = prev;
+        hashDict[index].c = c;
+        lookupPrev[numLookups] = prev;
+        lookupChar[numLookups] = c;
+        numLookups++;
+    }
+}
+
+static void findHits(size_t operations) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < operations; i++) {
+        size_t entry = (i * 7919) % numLookups;
+        sum += findIndex(hashDict, lookupPrev[entry], lookupChar[entry]);
+    }
+    sink += sum;
+}
+
+static void findMisses(size_t operations) {
+    // Bytes outside of the alphabet are never in the dictionary.
+    uint64_t sum = 0;
+    for (size_t i = 0; i < operations; i++) {
+        size_t entry = (i * 7919) % numLookups;
+        sum += findIndex(hashDict, lookupPrev[entry], lookupChar[entry] + 64);
+    }
+    sink += sum;
+}
+
+static void resetState(void) {
+    state.bytesInGroup = 0;
+    state.bufferOffset = 0;
+    state.inputSize = BUFFER_SIZE;
+    state.currentBits = codeBits;
+    state.bitOffset = 0;
+    state.outputBytes = 0;
+    state.inputBytes = 0;
+}
+
+static void writeCodes(size_t operations) {
+    resetState();
+    uint16_t mask = (1 << codeBits) - 1;
+    for (size_t i = 0; i < operations; i++) {
+        writeCode(-1, (i * 40503) & mask, &state);
+    }
+    sink += state.outputBytes;
+}
+
+static void readCodes(size_t operations) {
+    resetState();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < operations; i++) {
+        // Stay within the buffer so that no input is read.
+        if (state.bufferOffset + 4 > state.inputSize) {
+            state.bufferOffset = 0;
+            state.bitOffset = 0;
+        }
+        uint16_t code;
+        readCode(-1, &code, &state);
+        sum += code;
+    }
+    sink += sum;
+}
+
+static void writePaddings(size_t operations) {
+    resetState();
+    uint16_t mask = (1 << codeBits) - 1;
+    for (size_t i = 0; i < operations; i++) {
+        writeCode(-1, i & mask, &state);
+        writePadding(-1, &state);
+    }
+    sink += state.outputBytes;
+}
+
+static void discardPaddings(size_t operations) {
+    resetState();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < operations; i++) {
+        if (state.bufferOffset + 2 * codeBits + 4 > state.inputSize) {
+            state.bufferOffset = 0;
+            state.bitOffset = 0;
+        }
+        uint16_t code;
+        readCode(-1, &code, &state);
+        discardPadding(-1, &state);
+        sum += code;
+    }
+    sink += sum;
+}
+
+// Builds a full 16-bit dictionary for decompression. With literalPercent
+// percent of the entries extending a single byte the chains stay short,
+// otherwise they extend random earlier codes.
+static void fillChainDict(unsigned int literalPercent) {
+    size_t entries = (1 << 16) - DICT_OFFSET;
+    for (size_t i = 0; i < entries; i++) {
+        uint16_t prev;
+        if (i == 0 || nextRandom() % 100 < literalPercent) {
+            prev = nextRandom() % 256;
+        } else {
+            prev = DICT_OFFSET + nextRandom() % i;
+        }
+        chainDict[i].prev = prev;
+        chainDict[i].c = nextRandom();
+    }
+    for (size_t i = 0; i < WALK_OPERATIONS; i++) {
+        walkCodes[i] = DICT_OFFSET + nextRandom() % entries;
+    }
+}
+
+static void walkChains(size_t operations) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < operations; i++) {
+        size_t length;
+        sum += walkChain(chainDict, walkCodes[i], DICT_OFFSET, &length);
+        sum += length;
+    }
+    sink += sum;
+}
+
+int main(void) {
+    hashDict = malloc(HASHDICT_SIZE * sizeof(struct HashDict));
+    lookupPrev = malloc((1 << 16) * sizeof(uint16_t));
+    lookupChar = malloc(1 << 16);
+    chainDict = malloc((1 << 16) * sizeof(struct dict));
+    walkCodes = malloc(WALK_OPERATIONS * sizeof(uint16_t));
+    if (!hashDict || !lookupPrev || !lookupChar || !chainDict || !walkCodes) {
+        fputs("lzwbench: out of memory\n", stderr);
+        return 1;
+    }
+    for (size_t i = 0; i < BUFFER_SIZE; i++) {
+        state.buffer[i] = nextRandom();
+    }
+
+    int counter = openCounter();
+    printf("%-28s %10s %14s\n", "kernel", "ns/op", "cache-miss/op");
+
+    static const unsigned int dictBits[] = { 12, 16 };
+    for (size_t i = 0; i < sizeof(dictBits) / sizeof(dictBits[0]); i++) {
+        char name[64];
+        fillHashDict(dictBits[i]);
+        snprintf(name, sizeof(name), "findIndex hit, %u bits", dictBits[i]);
+        run(name, findHits, OPERATIONS, counter);
+        snprintf(name, sizeof(name), "findIndex miss, %u bits", dictBits[i]);
+        run(name, findMisses, OPERATIONS, counter);
+    }
+
+    static const unsigned int ioBits[] = { 9, 12, 16 };
+    for (size_t i = 0; i < sizeof(ioBits) / sizeof(ioBits[0]); i++) {
+        char name[64];
+        codeBits = ioBits[i];
+        snprintf(name, sizeof(name), "writeCode, %u bits", codeBits);
+        run(name, writeCodes, OPERATIONS, counter);
+        snprintf(name, sizeof(name), "readCode, %u bits", codeBits);
+        run(name, readCodes, OPERATIONS, counter);
+        snprintf(name, sizeof(name), "writeCode+Padding, %u bits", codeBits);
+        run(name, writePaddings, OPERATIONS, counter);
+        snprintf(name, sizeof(name), "readCode+discard, %u bits", codeBits);
+        run(name, discardPaddings, OPERATIONS, counter);
+    }
+
+    fillChainDict(80);
+    run("walkChain, short chains", walkChains, WALK_OPERATIONS, counter);
+    fillChainDict(0);
+    run("walkChain, long chains", walkChains, WALK_OPERATIONS, counter);
+
+    if (counter < 0) {
+        fputs("Cache misses are not available because perf_event_open "
+                "failed.\n", stderr);
+    }
+    return 0;
+}
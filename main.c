@@ -1,4 +1,4 @@
-/* Copyright (c) 2020, 2022, 2023, 2024 Dennis Wölfing
+/* Copyright (c) 2020, 2022, 2023, 2024, 2026 Dennis Wölfing
  *
  * Permission to use, copy, modify, and/or distribute this software for any
  * purpose with or without fee is hereby granted, provided that the above
@@ -38,6 +38,9 @@ static const struct algorithm* algorithms[] = {
     &algoLzw,
     &algoDeflate,
     &algoXz,
+    &algoLz4,
+    &algoBzip2,
+    &algoZstd,
     NULL
 };
 
@@ -46,44 +49,160 @@ struct outputinfo {
     int outputFd;
     const char* dirPath;
     const char* outputName;
+    // Compression is aborted if there are no savings after this many bytes.
+    off_t probeSize;
+    // Compression is aborted after this many bytes when sampling the input.
+    off_t sampleSize;
+    // Compression is aborted when the output gets larger than this size of
+    // another result, unless it is negative.
+    _Atomic off_t* smallest;
+    // Whether progress is shown for this output.
+    bool progress;
 };
 
+// Algorithm and level that compete when using --best-of.
+struct candidate {
+    const struct algorithm* algorithm;
+    int level;
+    // Whether the user agreed to replace the existing output of this
+    // candidate.
+    bool replace;
+};
+
+static bool checkRaceOutputs(int dirFd, const char* outputName,
+        const char* baseName, const char* dirPath);
+static void copyMetadata(int output, const struct stat* inputStat,
+        const struct timespec* modificationTime, const char* dirPath,
+        const char* outputName);
+static int copyRaceOutput(int output, struct fileinfo* info);
+static void finishTrace(void);
 static const struct algorithm* getAlgorithm(const char* name);
+static const struct algorithm* getAlgorithmByExtension(const char* extension);
 static bool getConfirmation(const char* dirPath, const char* filename);
+static char* getOutputName(const char* baseName,
+        const struct algorithm* algo);
+static const char* getResultString(int result);
+static bool hasExtension(const char* filename,
+        const struct algorithm* algo);
+static bool hasOutputExtension(const char* filename);
 static bool hasSuffix(const char* string, const char* suffix);
 static const struct algorithm* handleExtensions(const char* filename,
         const char** inputName, const char** outputName, char** allocatedName);
 static void list(const struct fileinfo* info, const char* dirPath);
 static int nullDecompress(int input, int output, struct fileinfo* info,
         const unsigned char* buffer, size_t bufferSize);
+static int openInputFile(int dirFd, const char* inputName,
+        const char* inputPath, struct stat* inputStat);
 static void outOfMemory(void);
-static void printWarning(const char* format, ...);
+static bool parseCandidates(char* list);
+static bool parseSize(const char* string, uint64_t* result);
+static void printResult(const char* operation, double ratio,
+        const char* action, const char* dirPath, const char* outputName);
 static const struct algorithm* probe(int input, unsigned char* buffer,
         size_t* bufferUsed, size_t bufferSize);
 static int processDirectory(int parentFd, const char* dirname,
         const char* pathname);
 static int processFile(int dirFd, const char* inputName, const char* outputName,
+        const char* baseName, const char* inputPath, const char* dirPath);
+static int processFormat(int dirFd, const char* inputName,
+        const char* outputName, const char* baseName, const char* inputPath,
+        const char* dirPath);
+static int processFormats(int dirFd, const char* inputName,
         const char* inputPath, const char* dirPath);
 static int processOperand(const char* filename);
+static void raceAlgorithms(int input, const char* inputName,
+        const struct stat* inputStat);
+static int runBenchmark(char* files[], int numFiles, char* algorithmNames,
+        int lastLevel);
+static void selectAlgorithm(int dirFd, const char* inputName);
+static void setMetadata(struct fileinfo* info, const char* inputName,
+        const struct stat* inputStat);
+static bool skipIncompressible(int input, const struct stat* inputStat,
+        const char* inputPath, const char* dirPath);
+static bool unlinkInput(int dirFd, const char* inputName,
+        const char* inputPath);
+static void writeFileMetrics(const char* path,
+        const struct algorithm* algorithm, int level,
+        const struct fileinfo* info, int result, bool skipped,
+        const struct stats* stats);
 
 static const struct algorithm algoNull = {
     .decompress = nullDecompress,
 };
 
-enum { MODE_COMPRESS, MODE_DECOMPRESS, MODE_TEST, MODE_LIST };
+enum { MODE_COMPRESS, MODE_DECOMPRESS, MODE_TEST, MODE_LIST, MODE_BENCHMARK };
+
+// Values returned by getopt_long for options that only have a long form.
+enum {
+    OPT_APPEND = 1,
+    OPT_ARGV0,
+    OPT_BENCHMARK,
+    OPT_BEST_OF,
+    OPT_CHECKPOINT,
+    OPT_CHECKPOINT_INTERVAL,
+    OPT_FLUSH_BYTES,
+    OPT_FLUSH_INTERVAL,
+    OPT_FORMATS,
+    OPT_LONG,
+    OPT_MEMORY_LIMIT,
+    OPT_METRICS_JSON,
+    OPT_PROBE_SIZE,
+    OPT_PROGRESS,
+    OPT_RECOMPRESS,
+    OPT_STATS,
+    OPT_TARGET_RATIO,
+    OPT_TARGET_SPEED,
+    OPT_TRACE,
+    OPT_ULTRA,
+};
+
+// Amount of input compressed between two checkpoints.
+#define DEFAULT_CHECKPOINT_INTERVAL (64 * 1024 * 1024)
+// Default speed for automatic algorithm selection when no target was given.
+#define DEFAULT_TARGET_SPEED (50 * 1024 * 1024)
+// Amount of input compressed to estimate the ratio for automatic selection.
+#define SAMPLE_SIZE (256 * 1024)
+
 static const struct algorithm* algorithm;
+static bool append = false;
+static bool autoSelect = false;
+static bool benchmarkCsv = false;
+static struct candidate* candidates = NULL;
+uint64_t checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL;
+static const char* checkpointPath = NULL;
+static size_t numCandidates = 0;
+uint64_t flushBytes = 0;
+unsigned long flushInterval = 0;
 static bool force = false;
 static const char* givenOutputName = NULL;
 static bool keep = false;
+static bool multipleFormats = false;
 static int level = -1;
+int longWindowLog = 0;
 int maxThreads = -1;
+static bool measureFiles = false;
+static int metricsFd = -1;
 static int mode = MODE_COMPRESS;
+static uint64_t probeSize = 0;
+// Result of the last --best-of race that is used by the next processFile call.
+static bool raced = false;
+static bool recompress = false;
+static struct fileinfo raceInfo;
+static int raceOutput = -1;
+static int raceResult;
 static bool restoreName = false;
 static bool saveName = true;
+static bool showProgress = false;
+static bool showStats = false;
 static const char* programName;
 static bool quiet = false;
 static bool recursive = false;
 static const char* suffix = NULL;
+static double targetRatio = 0;
+static struct stats totalStats;
+static const char* tracePath = NULL;
+uint64_t targetSpeed = 0;
+static bool ultra = false;
 static bool verbose = false;
 static bool writeToStdout = false;
 
@@ -91,25 +210,45 @@ int main(int argc, char* argv[]) {
     programName = argv[0];
 
     struct option longopts[] = {
-        { "argv0", required_argument, 0, 1 },
+        { "append", no_argument, 0, OPT_APPEND },
+        { "argv0", required_argument, 0, OPT_ARGV0 },
         { "ascii", no_argument, 0, 'a' },
         { "best", no_argument, &level, -3 },
+        { "benchmark", optional_argument, 0, OPT_BENCHMARK },
+        { "best-of", required_argument, 0, OPT_BEST_OF },
+        { "checkpoint", required_argument, 0, OPT_CHECKPOINT },
+        { "checkpoint-interval", required_argument, 0,
+                OPT_CHECKPOINT_INTERVAL },
         { "compress", no_argument, 0, 'z' },
         { "decompress", no_argument, 0, 'd' },
         { "fast", no_argument, &level, -2 },
+        { "flush-bytes", required_argument, 0, OPT_FLUSH_BYTES },
+        { "flush-interval", required_argument, 0, OPT_FLUSH_INTERVAL },
         { "force", no_argument, 0, 'f' },
+        { "formats", required_argument, 0, OPT_FORMATS },
         { "help", no_argument, 0, 'h' },
         { "keep", no_argument, 0, 'k' },
         { "list", no_argument, 0, 'l' },
+        { "long", optional_argument, 0, OPT_LONG },
+        { "memory-limit", required_argument, 0, OPT_MEMORY_LIMIT },
+        { "metrics-json", required_argument, 0, OPT_METRICS_JSON },
         { "name", no_argument, 0, 'N' },
         { "no-name", no_argument, 0, 'n' },
+        { "probe-size", required_argument, 0, OPT_PROBE_SIZE },
+        { "progress", no_argument, 0, OPT_PROGRESS },
         { "quiet", no_argument, 0, 'q' },
+        { "recompress", no_argument, 0, OPT_RECOMPRESS },
         { "recursive", no_argument, 0, 'r' },
+        { "stats", no_argument, 0, OPT_STATS },
         { "stdout", no_argument, 0, 'c' },
         { "suffix", required_argument, 0, 'S' },
+        { "target-ratio", required_argument, 0, OPT_TARGET_RATIO },
+        { "target-speed", required_argument, 0, OPT_TARGET_SPEED },
         { "test", no_argument, 0, 't' },
         { "threads", required_argument, 0, 'T' },
         { "to-stdout", no_argument, 0, 'c' },
+        { "trace", required_argument, 0, OPT_TRACE },
+        { "ultra", no_argument, 0, OPT_ULTRA },
         { "uncompress", no_argument, 0, 'd' },
         { "verbose", no_argument, 0, 'v' },
         { "version", no_argument, 0, 'V' },
@@ -117,14 +256,124 @@ int main(int argc, char* argv[]) {
     };
 
     const char* algorithmName = NULL;
+    char* bestOfList = NULL;
+    int lastLevel = -1;
+    char* formatList = NULL;
+    const char* metricsPath = NULL;
 
     int c;
     const char* opts = "0123456789ab:cdfghklm:nNo:OqrS:tT:vVz";
     while ((c = getopt_long(argc, argv, opts, longopts, NULL)) != -1) {
         switch (c) {
-        case 1: // undocumented --argv0 option for internal use only
+        case OPT_APPEND:
+            append = true;
+            break;
+        case OPT_ARGV0: // undocumented option for internal use only
             programName = argv[0] = optarg;
             break;
+        case OPT_BENCHMARK:
+            if (optarg && strcmp(optarg, "csv") == 0) {
+                benchmarkCsv = true;
+            } else if (optarg && strcmp(optarg, "text") != 0) {
+                printWarning("invalid benchmark format: '%s'", optarg);
+                return 1;
+            }
+            mode = MODE_BENCHMARK;
+            break;
+        case OPT_BEST_OF:
+            bestOfList = optarg;
+            break;
+        case OPT_CHECKPOINT:
+            checkpointPath = optarg;
+            break;
+        case OPT_CHECKPOINT_INTERVAL:
+            if (!parseSize(optarg, &checkpointInterval) ||
+                    checkpointInterval == 0) {
+                printWarning("invalid checkpoint interval: '%s'", optarg);
+                return 1;
+            }
+            break;
+        case OPT_FLUSH_BYTES:
+            if (!parseSize(optarg, &flushBytes) || flushBytes == 0) {
+                printWarning("invalid flush size: '%s'", optarg);
+                return 1;
+            }
+            break;
+        case OPT_FLUSH_INTERVAL: {
+            char* end;
+            errno = 0;
+            flushInterval = strtoul(optarg, &end, 10);
+            if (errno || *end || flushInterval == 0 ||
+                    flushInterval > INT_MAX) {
+                printWarning("invalid flush interval: '%s'", optarg);
+                return 1;
+            }
+        } break;
+        case OPT_FORMATS:
+            formatList = optarg;
+            break;
+        case OPT_LONG:
+            if (!optarg) {
+                longWindowLog = 27;
+            } else {
+                char* end;
+                unsigned long value = strtoul(optarg, &end, 10);
+                if (*end || value < 10 || value > 31) {
+                    printWarning("invalid window size: '%s'", optarg);
+                    return 1;
+                }
+                longWindowLog = value;
+            }
+            break;
+        case OPT_MEMORY_LIMIT:
+            if (!parseSize(optarg, &memoryLimit)) {
+                printWarning("invalid memory limit: '%s'", optarg);
+                return 1;
+            }
+            break;
+        case OPT_METRICS_JSON:
+            metricsPath = optarg;
+            break;
+        case OPT_PROBE_SIZE:
+            if (!parseSize(optarg, &probeSize) || probeSize > INTMAX_MAX) {
+                printWarning("invalid probe size: '%s'", optarg);
+                return 1;
+            }
+            break;
+        case OPT_PROGRESS:
+            showProgress = true;
+            break;
+        case OPT_RECOMPRESS:
+            recompress = true;
+            break;
+        case OPT_STATS:
+            showStats = true;
+            break;
+        case OPT_TARGET_RATIO: {
+            char* end;
+            errno = 0;
+            targetRatio = strtod(optarg, &end);
+            if (errno || *end || !(targetRatio >= 1.0)) {
+                printWarning("invalid target ratio: '%s'", optarg);
+                return 1;
+            }
+        } break;
+        case OPT_TARGET_SPEED: {
+            size_t length = strlen(optarg);
+            if (length > 2 && strcmp(optarg + length - 2, "/s") == 0) {
+                optarg[length - 2] = '\0';
+            }
+            if (!parseSize(optarg, &targetSpeed) || targetSpeed == 0) {
+                printWarning("invalid target speed: '%s'", optarg);
+                return 1;
+            }
+        } break;
+        case OPT_TRACE:
+            tracePath = optarg;
+            break;
+        case OPT_ULTRA:
+            ultra = true;
+            break;
         case '0': case '1': case '2': case '3': case '4': case '5': case '6':
         case '7': case '8': case '9':
             level = c - '0';
@@ -135,11 +384,17 @@ int main(int argc, char* argv[]) {
         case 'b': {
             char* end;
             unsigned long value = strtoul(optarg, &end, 10);
-            if (*end || value > INT_MAX) {
+            unsigned long last = value;
+            if (*end == '-') {
+                // Ranges of levels are used by --benchmark.
+                last = strtoul(end + 1, &end, 10);
+            }
+            if (*end || last > INT_MAX || last < value) {
                 printWarning("invalid compression level: '%s'", optarg);
                 return 1;
             }
             level = value;
+            lastLevel = last != value ? (int) last : -1;
         } break;
         case 'c':
             writeToStdout = true;
@@ -155,24 +410,44 @@ int main(int argc, char* argv[]) {
             break;
         case 'h':
             printf("Usage: %s [OPTIONS] [FILE...]\n"
+"      --append             append to existing compressed files\n"
 "  -b LEVEL                 set the compression level\n"
+"      --benchmark[=csv]    measure compression speed of the files\n"
+"      --best-of=ALGOS      keep the smallest output of several algorithms\n"
 "  -c, --stdout             write output to stdout\n"
+"      --checkpoint=FILE    record progress in FILE to resume compression\n"
+"      --checkpoint-interval=SIZE\n"
+"                           record progress after every SIZE bytes\n"
 "  -d, --decompress         decompress files\n"
 "  -f, --force              force compression\n"
+"      --flush-bytes=SIZE   flush the output after SIZE bytes of input\n"
+"      --flush-interval=MS  flush the output when input is MS ms old\n"
+"      --formats=FORMATS    write a compressed file for each format at once\n"
 "  -g                       use the gzip algorithm for compression\n"
 "  -h, --help               display this help\n"
 "  -k, --keep               do not unlink input files\n"
 "  -l, --list               list information about compressed files\n"
+"      --long[=WLOG]        use long distance matching for zstd\n"
 "  -m ALGO                  use the ALGO algorithm for compression\n"
+"      --memory-limit=SIZE  limit the memory used by parallel compression\n"
+"      --metrics-json=FILE  append a JSON record for each file to FILE\n"
 "  -n, --no-name            do not save file name and time stamp\n"
 "  -N, --name               use file name and time from compressed files\n"
 "  -o FILENAME              write output to FILENAME\n"
 "  -O                       use the lzw algorithm for compression\n"
+"      --probe-size=SIZE    give up on files not smaller after SIZE bytes\n"
+"      --progress           show the progress of each file\n"
 "  -q, --quiet              suppress warning messages\n"
+"      --recompress         convert compressed files to another format\n"
 "  -r, --recursive          recursively (de)compress files in directories\n"
+"      --stats              print time and I/O statistics for each file\n"
 "  -S, --suffix=SUFFIX      use SUFFIX as suffix for compressed files\n"
+"      --target-ratio=R     with -m auto, aim for a compression ratio of R:1\n"
+"      --target-speed=SPEED compress at least SPEED bytes/s\n"
 "  -t, --test               check file integrity\n"
 "  -T, --threads=THREADS    use up to the given number of threads\n"
+"      --trace=FILE         write a timeline of all threads to FILE\n"
+"      --ultra              allow zstd compression levels up to 22\n"
 "  -v, --verbose            print filenames and compression ratios\n"
 "  -V, --version            display version info\n"
 "  -z, --compress           compress files\n",
@@ -253,20 +528,81 @@ argv[0]);
         }
     }
 
-    if (mode == MODE_COMPRESS) {
+    if (mode == MODE_BENCHMARK) {
+        return runBenchmark(argv + optind, argc - optind, (char*) algorithmName,
+                lastLevel);
+    }
+    if (lastLevel != -1) {
+        printWarning("level ranges can only be used with --benchmark");
+        return 1;
+    }
+
+    if (recompress && mode == MODE_COMPRESS && (formatList || bestOfList ||
+            (algorithmName && strcmp(algorithmName, "auto") == 0))) {
+        printWarning("the --recompress option cannot be used with --best-of, "
+                "--formats or -m auto");
+        return 1;
+    }
+
+    if (append && mode == MODE_COMPRESS && (formatList || bestOfList ||
+            recompress || writeToStdout ||
+            (algorithmName && strcmp(algorithmName, "auto") == 0))) {
+        printWarning("the --append option cannot be used with --best-of, "
+                "--formats, --recompress, -c or -m auto");
+        return 1;
+    }
+
+    if (checkpointPath && mode == MODE_COMPRESS && (formatList ||
+            bestOfList || recompress || append || writeToStdout ||
+            (algorithmName && strcmp(algorithmName, "auto") == 0))) {
+        printWarning("the --checkpoint option cannot be used with --append, "
+                "--best-of, --formats, --recompress, -c or -m auto");
+        return 1;
+    }
+
+    if (mode == MODE_COMPRESS && formatList) {
+        if (bestOfList || givenOutputName || writeToStdout || suffix) {
+            printWarning("the --formats option cannot be used with --best-of "
+                    "or any of the -coS options");
+            return 1;
+        }
+        if (!parseCandidates(formatList)) return 1;
+        multipleFormats = true;
+        algorithm = candidates[0].algorithm;
+        level = candidates[0].level;
+    } else if (mode == MODE_COMPRESS && bestOfList) {
+        if (!parseCandidates(bestOfList)) return 1;
+        algorithm = candidates[0].algorithm;
+        level = candidates[0].level;
+    } else if (mode == MODE_COMPRESS) {
         if (!algorithmName) algorithmName = "lzw";
+        if (strcmp(algorithmName, "auto") == 0) {
+            // The algorithm and level are selected for each file.
+            autoSelect = true;
+            size_t count;
+            getCalibration(&count, verbose);
+            algorithmName = "lzw";
+        }
         algorithm = getAlgorithm(algorithmName);
         if (!algorithm) {
             printWarning("unknown compression algorithm '%s'", algorithmName);
             return 3;
         }
+        if ((append || checkpointPath) && algorithm == &algoLzw) {
+            // LZW decoders cannot decompress concatenated files.
+            printWarning("the %s option cannot be used with the lzw "
+                    "algorithm", append ? "--append" : "--checkpoint");
+            return 1;
+        }
+        int maxLevel = algorithm->maxLevel;
+        if (ultra && algorithm->ultraLevel) maxLevel = algorithm->ultraLevel;
         if (level == -1) {
             level = algorithm->defaultLevel;
         } else if (level == -2) {
             level = algorithm->minLevel;
         } else if (level == -3) {
-            level = algorithm->maxLevel;
-        } else if (level < algorithm->minLevel || level > algorithm->maxLevel) {
+            level = maxLevel;
+        } else if (level < algorithm->minLevel || level > maxLevel) {
             printWarning("invalid compression level: '%d'", level);
             return 1;
         }
@@ -277,6 +613,23 @@ argv[0]);
         puts("compressed  uncompressed  ratio  uncompressed name");
     }
 
+    if (metricsPath) {
+        metricsFd = open(metricsPath, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                0666);
+        if (metricsFd < 0) {
+            printWarning("cannot open '%s': %s", metricsPath, strerror(errno));
+            return 1;
+        }
+    }
+    if (tracePath) {
+        if (!startTrace(tracePath)) {
+            printWarning("cannot create '%s': %s", tracePath, strerror(errno));
+            return 1;
+        }
+        atexit(finishTrace);
+    }
+    measureFiles = showStats || metricsFd >= 0 || tracing;
+
     int status = 0;
     if (optind >= argc) {
         status = processOperand("-");
@@ -286,9 +639,104 @@ argv[0]);
         int result = processOperand(argv[i]);
         if (status == 0 || result == 1) status = result;
     }
+    if (showStats && totalStats.files > 1) {
+        printStats("total", &totalStats);
+    }
+    freeCaches();
+    free(candidates);
     return status;
 }
 
+void freeCaches(void) {
+    for (size_t i = 0; algorithms[i]; i++) {
+        algorithms[i]->freeCache();
+    }
+}
+
+static bool checkRaceOutputs(int dirFd, const char* outputName,
+        const char* baseName, const char* dirPath) {
+    // The winner is only known after the race, so all outputs that it could
+    // replace are confirmed before compressing the file.
+    for (size_t i = 0; i < numCandidates; i++) {
+        candidates[i].replace = false;
+        if (force || append || (!outputName && !baseName)) continue;
+        bool duplicate = false;
+        for (size_t j = 0; j < i; j++) {
+            if (outputName || candidates[j].algorithm ==
+                    candidates[i].algorithm) {
+                candidates[i].replace = candidates[j].replace;
+                duplicate = true;
+                break;
+            }
+        }
+        if (duplicate) continue;
+
+        char* name = outputName ? NULL :
+                getOutputName(baseName, candidates[i].algorithm);
+        const char* path = outputName ? outputName : name;
+        struct stat st;
+        if (fstatat(dirFd, path, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            if (!getConfirmation(dirPath, path)) {
+                printWarning("cannot create file '%s%s%s': %s",
+                        dirPath ? dirPath : "", dirPath ? "/" : "", path,
+                        strerror(EEXIST));
+                free(name);
+                return false;
+            }
+            candidates[i].replace = true;
+        }
+        free(name);
+    }
+    return true;
+}
+
+static void copyMetadata(int output, const struct stat* inputStat,
+        const struct timespec* modificationTime, const char* dirPath,
+        const char* outputName) {
+    if (fchown(output, inputStat->st_uid, inputStat->st_gid) < 0 && !quiet) {
+        printWarning("cannot set ownership for '%s%s%s': %s",
+                dirPath ? dirPath : "", dirPath ? "/" : "", outputName,
+                strerror(errno));
+    }
+
+    fchmod(output, inputStat->st_mode);
+    struct timespec ts[2] = { inputStat->st_atim, inputStat->st_mtim };
+    if (modificationTime) {
+        ts[0] = ts[1] = *modificationTime;
+    }
+    futimens(output, ts);
+}
+
+static int copyRaceOutput(int output, struct fileinfo* info) {
+    raced = false;
+    int result = RESULT_OK;
+    if (lseek(raceOutput, 0, SEEK_SET) < 0) result = RESULT_READ_ERROR;
+    while (result == RESULT_OK) {
+        char buffer[8 * 4096];
+        ssize_t readSize = read(raceOutput, buffer, sizeof(buffer));
+        if (readSize == 0) break;
+        if (readSize < 0) {
+            result = RESULT_READ_ERROR;
+        } else if (writeAll(output, buffer, readSize) < 0) {
+            result = RESULT_WRITE_ERROR;
+        }
+    }
+    close(raceOutput);
+    raceOutput = -1;
+
+    info->compressedSize = raceInfo.compressedSize;
+    info->uncompressedSize = raceInfo.uncompressedSize;
+    info->crc = raceInfo.crc;
+    info->threads = raceInfo.threads;
+    return result;
+}
+
+static void finishTrace(void) {
+    if (!writeTrace()) {
+        printWarning("cannot write '%s': %s", tracePath, strerror(errno));
+    }
+}
+
 static const struct algorithm* getAlgorithm(const char* name) {
     size_t nameLength = strlen(name);
     for (size_t i = 0; algorithms[i]; i++) {
@@ -305,6 +753,18 @@ static const struct algorithm* getAlgorithm(const char* name) {
     return NULL;
 }
 
+static const struct algorithm* getAlgorithmByExtension(const char* extension) {
+    size_t length = strlen(extension);
+    for (size_t i = 0; algorithms[i]; i++) {
+        const char* extensions = algorithms[i]->extensions;
+        if (strcspn(extensions, ",") == length &&
+                strncmp(extensions, extension, length) == 0) {
+            return algorithms[i];
+        }
+    }
+    return NULL;
+}
+
 static bool getConfirmation(const char* dirPath, const char* filename) {
     if (!isatty(0)) return false;
     fprintf(stderr, "File '%s%s%s' already exists, overwrite? ",
@@ -317,6 +777,21 @@ static bool getConfirmation(const char* dirPath, const char* filename) {
     return response == 'y' || response == 'Y';
 }
 
+static char* getOutputName(const char* baseName,
+        const struct algorithm* algo) {
+    const char* extension = algo->extensions;
+    size_t extensionLength = strcspn(extension, ",");
+    if (suffix) {
+        extension = suffix;
+        extensionLength = strlen(suffix);
+    }
+    char* outputName = malloc(strlen(baseName) + extensionLength + 2);
+    if (!outputName) outOfMemory();
+    *stpncpy(stpcpy(stpcpy(outputName, baseName), "."), extension,
+            extensionLength) = '\0';
+    return outputName;
+}
+
 static size_t reverse_strcspn(const char* s, const char* set) {
     const char* current = NULL;
     while (*set) {
@@ -392,6 +867,42 @@ static const struct algorithm* handleExtensions(const char* filename,
     return NULL;
 }
 
+static const char* getResultString(int result) {
+    return result == RESULT_FORMAT_ERROR ? "file format error" :
+            result == RESULT_READ_ERROR ? "read error" :
+            result == RESULT_WRITE_ERROR ? "write error" :
+            result == RESULT_UNRECOGNIZED_FORMAT ? "unrecognized format" :
+            result == RESULT_OUT_OF_MEMORY ? "out of memory" :
+            result == RESULT_UNIMPLEMENTED_FORMAT ?
+            "file format unimplemented" : "unknown error";
+}
+
+static bool hasExtension(const char* filename,
+        const struct algorithm* algo) {
+    size_t length = strlen(filename);
+    size_t extensionLength = strcspn(algo->extensions, ",");
+    if (length <= extensionLength + 1) return false;
+    if (filename[length - extensionLength - 1] != '.') return false;
+    return strncmp(filename + (length - extensionLength), algo->extensions,
+            extensionLength) == 0;
+}
+
+static bool hasOutputExtension(const char* filename) {
+    if (suffix) return hasSuffix(filename, suffix);
+    if (candidates && !multipleFormats) {
+        for (size_t i = 0; i < numCandidates; i++) {
+            if (hasExtension(filename, candidates[i].algorithm)) return true;
+        }
+        return false;
+    }
+    if (!autoSelect) return hasExtension(filename, algorithm);
+    // Any algorithm could be selected for the file.
+    for (size_t i = 0; algorithms[i]; i++) {
+        if (hasExtension(filename, algorithms[i])) return true;
+    }
+    return false;
+}
+
 static bool hasSuffix(const char* string, const char* suffix) {
     size_t length = strlen(string);
     size_t suffixLength = strlen(suffix);
@@ -433,7 +944,7 @@ static int nullDecompress(int input, int output, struct fileinfo* info,
 
     while (true) {
         char readBuffer[8 * 4096];
-        ssize_t readSize = read(input, readBuffer, sizeof(readBuffer));
+        ssize_t readSize = readInput(input, readBuffer, sizeof(readBuffer));
         if (readSize == 0) return RESULT_OK;
         if (readSize < 0) return RESULT_READ_ERROR;
 
@@ -442,6 +953,26 @@ static int nullDecompress(int input, int output, struct fileinfo* info,
     }
 }
 
+static int openInputFile(int dirFd, const char* inputName,
+        const char* inputPath, struct stat* inputStat) {
+    int input = openat(dirFd, inputName, O_RDONLY | O_NOFOLLOW);
+    if (input < 0) {
+        printWarning("cannot open '%s': %s", inputPath, strerror(errno));
+        return -1;
+    }
+    if (fstat(input, inputStat) < 0) {
+        printWarning("cannot stat '%s': %s", inputPath, strerror(errno));
+        close(input);
+        return -1;
+    }
+    if (!S_ISREG(inputStat->st_mode)) {
+        printWarning("cannot open '%s': Not a regular file", inputPath);
+        close(input);
+        return -1;
+    }
+    return input;
+}
+
 int openOutputFile(const char* outputName, struct outputinfo* oinfo) {
     if (!outputName) outputName = oinfo->outputName;
 
@@ -454,6 +985,18 @@ int openOutputFile(const char* outputName, struct outputinfo* oinfo) {
         return -1;
     }
 
+    if (append && mode == MODE_COMPRESS) {
+        oinfo->outputFd = openat(oinfo->dirFd, outputName,
+                O_RDWR | O_APPEND | O_CREAT | O_NOFOLLOW, 0666);
+        if (oinfo->outputFd < 0) {
+            printWarning("cannot open '%s%s%s': %s",
+                    oinfo->dirPath ? oinfo->dirPath : "",
+                    oinfo->dirPath ? "/" : "", outputName, strerror(errno));
+        }
+        if (measureFiles) trackStats(oinfo->outputFd);
+        return oinfo->outputFd;
+    }
+
     if (force) {
         unlinkat(oinfo->dirFd, outputName, 0);
     }
@@ -473,6 +1016,7 @@ int openOutputFile(const char* outputName, struct outputinfo* oinfo) {
                 oinfo->dirPath ? oinfo->dirPath : "", oinfo->dirPath ? "/" : "",
                 outputName, strerror(errno));
     }
+    if (measureFiles) trackStats(oinfo->outputFd);
     return oinfo->outputFd;
 }
 
@@ -481,7 +1025,84 @@ static void outOfMemory(void) {
     exit(1);
 }
 
-static void printWarning(const char* format, ...) {
+static bool parseCandidates(char* list) {
+    size_t count = 1;
+    for (const char* p = list; *p; p++) {
+        if (*p == ',') count++;
+    }
+    candidates = malloc(count * sizeof(struct candidate));
+    if (!candidates) outOfMemory();
+
+    char* savePtr;
+    for (char* name = strtok_r(list, ",", &savePtr); name;
+            name = strtok_r(NULL, ",", &savePtr)) {
+        char* levelString = strchr(name, ':');
+        if (levelString) *levelString++ = '\0';
+        const struct algorithm* candidate = getAlgorithm(name);
+        if (!candidate) candidate = getAlgorithmByExtension(name);
+        if (!candidate) {
+            printWarning("unknown compression algorithm '%s'", name);
+            return false;
+        }
+
+        int maxLevel = candidate->maxLevel;
+        if (ultra && candidate->ultraLevel) maxLevel = candidate->ultraLevel;
+        int candidateLevel = candidate->defaultLevel;
+        if (levelString) {
+            char* end;
+            unsigned long value = strtoul(levelString, &end, 10);
+            if (*end || !*levelString ||
+                    value < (unsigned long) candidate->minLevel ||
+                    value > (unsigned long) maxLevel) {
+                printWarning("invalid compression level: '%s'", levelString);
+                return false;
+            }
+            candidateLevel = value;
+        }
+        candidates[numCandidates].algorithm = candidate;
+        candidates[numCandidates].level = candidateLevel;
+        numCandidates++;
+    }
+
+    if (numCandidates == 0) {
+        printWarning("no algorithms given");
+        return false;
+    }
+    return true;
+}
+
+static bool parseSize(const char* string, uint64_t* result) {
+    char* end;
+    errno = 0;
+    uintmax_t value = strtoumax(string, &end, 10);
+    if (errno || end == string) return false;
+
+    unsigned int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    case 't': case 'T': shift = 40; end++; break;
+    }
+    if (shift && strcmp(end, "iB") == 0) end += 2;
+    if (strcmp(end, "B") == 0) end++;
+    if (*end || value > (UINT64_MAX >> shift)) return false;
+
+    *result = (uint64_t) value << shift;
+    return true;
+}
+
+static void printResult(const char* operation, double ratio,
+        const char* action, const char* dirPath, const char* outputName) {
+    fprintf(stderr, "%s %.2f%%", operation, ratio * 100.0);
+    if (action) {
+        fprintf(stderr, " - %s '%s%s%s'", action, dirPath ? dirPath : "",
+                dirPath ? "/" : "", outputName);
+    }
+    fputc('\n', stderr);
+}
+
+void printWarning(const char* format, ...) {
     va_list ap;
     va_start(ap, format);
     fputs(programName, stderr);
@@ -494,7 +1115,7 @@ static void printWarning(const char* format, ...) {
 static const struct algorithm* probe(int input, unsigned char* buffer,
         size_t* bufferUsed, size_t bufferSize) {
     while (bufferSize > 0) {
-        ssize_t bytesRead = read(input, buffer + *bufferUsed, bufferSize);
+        ssize_t bytesRead = readInput(input, buffer + *bufferUsed, bufferSize);
         if (bytesRead < 0) {
             *bufferUsed = -1;
             return NULL;
@@ -551,7 +1172,8 @@ static int processDirectory(int parentFd, const char* dirname,
             int result = processDirectory(fd, name, inputPath);
             if (status == 0 || result == 1) status = result;
         } else {
-            const char* outputName;
+            const char* outputName = NULL;
+            const char* baseName = NULL;
             char* allocatedName = NULL;
             if (mode != MODE_COMPRESS) {
                 algorithm = handleExtensions(name, NULL, &outputName,
@@ -559,32 +1181,30 @@ static int processDirectory(int parentFd, const char* dirname,
             } else {
                 // Skip files that already have the right extension so we don't
                 // compress the same file multiple times.
-                const char* extension = algorithm->extensions;
-                size_t extensionLength = strcspn(extension, ",");
-                if (suffix) {
-                    extension = suffix;
-                    extensionLength = strlen(suffix);
-                }
-                if (inputNameLength > extensionLength + 1 &&
-                        name[inputNameLength - extensionLength - 1] == '.' &&
-                        strncmp(&name[inputNameLength - extensionLength],
-                        extension, extensionLength) == 0) {
+                if (hasOutputExtension(name)) {
                     free(inputPath);
                     errno = 0;
                     dirent = readdir(dir);
                     continue;
                 }
 
-                allocatedName = malloc(inputNameLength + extensionLength + 2);
-                if (!allocatedName) outOfMemory();
-                *stpncpy(stpcpy(stpcpy(allocatedName, name), "."), extension,
-                        extensionLength) = '\0';
-                outputName = allocatedName;
+                // When recompressing only files with the extension of a
+                // compressed format are considered.
+                baseName = name;
+                if (recompress) {
+                    handleExtensions(name, NULL, &baseName, &allocatedName);
+                    if (!allocatedName) {
+                        free(inputPath);
+                        errno = 0;
+                        dirent = readdir(dir);
+                        continue;
+                    }
+                }
             }
 
             if (algorithm || suffix) {
-                int result = processFile(fd, name, outputName, inputPath,
-                        pathname);
+                int result = processFile(fd, name, outputName, baseName,
+                        inputPath, pathname);
                 if (status == 0 || result == 1) status = result;
             }
             free(allocatedName);
@@ -604,29 +1224,86 @@ static int processDirectory(int parentFd, const char* dirname,
     return status;
 }
 
+// When compressing into a file whose name depends on the selected algorithm,
+// outputName is NULL and the extension is appended to baseName.
 static int processFile(int dirFd, const char* inputName, const char* outputName,
-        const char* inputPath, const char* dirPath) {
+        const char* baseName, const char* inputPath, const char* dirPath) {
+    // The span covers files that fail or are skipped as well.
+    uint64_t fileStart = beginTraceFile();
+    int status;
+    if (multipleFormats && mode == MODE_COMPRESS) {
+        status = processFormats(dirFd, inputName, inputPath, dirPath);
+    } else {
+        status = processFormat(dirFd, inputName, outputName, baseName,
+                inputPath, dirPath);
+    }
+    endTraceFile(inputPath ? inputPath : "stdin", fileStart);
+    return status;
+}
+
+static int processFormat(int dirFd, const char* inputName,
+        const char* outputName, const char* baseName, const char* inputPath,
+        const char* dirPath) {
+    if (measureFiles) startStats();
+
     int input = 0;
     int output = 1;
     struct stat inputStat;
+    // Whether a checkpoint from which the output can be resumed exists.
+    bool checkpointed = false;
 
     struct outputinfo oinfo;
     oinfo.dirFd = dirFd;
     oinfo.outputFd = -1;
     oinfo.dirPath = dirPath;
     oinfo.outputName = outputName;
+    oinfo.probeSize = 0;
+    oinfo.sampleSize = 0;
+    oinfo.smallest = NULL;
+    oinfo.progress = showProgress;
 
     if (inputName) {
-        input = openat(dirFd, inputName, O_RDONLY | O_NOFOLLOW);
+        input = openInputFile(dirFd, inputName, inputPath, &inputStat);
         if (input < 0) {
-            printWarning("cannot open '%s': %s", inputPath, strerror(errno));
+            writeFileMetrics(inputPath, algorithm, level, NULL,
+                    RESULT_OPEN_FAILURE, false, NULL);
             return 1;
         }
-        fstat(input, &inputStat);
-        if (!S_ISREG(inputStat.st_mode)) {
-            printWarning("cannot open '%s': Not a regular file", inputPath);
-            close(input);
-            return 1;
+    }
+    if (measureFiles) trackStats(input);
+
+    if (mode == MODE_COMPRESS &&
+            skipIncompressible(input, &inputStat, inputPath, dirPath)) {
+        writeFileMetrics(inputPath, algorithm, level, NULL, RESULT_OK, true,
+                NULL);
+        close(input);
+        return 0;
+    }
+
+    char* allocatedName = NULL;
+    if (mode == MODE_COMPRESS) {
+        // The algorithm is only selected for files that are compressed.
+        if (autoSelect) {
+            selectAlgorithm(dirFd, inputName);
+        } else if (candidates && !multipleFormats && !recompress) {
+            if (!checkRaceOutputs(dirFd, outputName, baseName, dirPath)) {
+                writeFileMetrics(inputPath ? inputPath : "stdin", algorithm,
+                        level, NULL, RESULT_OPEN_FAILURE, false, NULL);
+                if (input != 0) close(input);
+                return 1;
+            }
+            raceAlgorithms(input, inputName, &inputStat);
+        }
+        if (!outputName && baseName) {
+            outputName = allocatedName = getOutputName(baseName, algorithm);
+            oinfo.outputName = outputName;
+        }
+        for (size_t i = 0; i < numCandidates && raced; i++) {
+            if (candidates[i].algorithm == algorithm &&
+                    candidates[i].replace) {
+                // The user was already asked before the race.
+                unlinkat(dirFd, outputName, 0);
+            }
         }
     }
 
@@ -634,24 +1311,94 @@ static int processFile(int dirFd, const char* inputName, const char* outputName,
         if (!writeToStdout && mode == MODE_DECOMPRESS && restoreName) {
             output = -2;
         } else if (!writeToStdout && mode != MODE_TEST && mode != MODE_LIST) {
-            output = openOutputFile(outputName, &oinfo);
+            output = -1;
+            if (checkpointPath && mode == MODE_COMPRESS && inputName) {
+                output = oinfo.outputFd = resumeCheckpoint(checkpointPath,
+                        input, dirFd, outputName);
+                checkpointed = output >= 0;
+            }
+            if (output < 0) output = openOutputFile(outputName, &oinfo);
             if (output < 0) {
+                writeFileMetrics(inputPath ? inputPath : "stdin",
+                        algorithm, level, NULL, RESULT_OPEN_FAILURE, false,
+                        NULL);
                 close(input);
+                free(allocatedName);
                 return 1;
             }
         }
     }
 
     if (mode == MODE_TEST || mode == MODE_LIST) output = -1;
+    if (measureFiles) trackStats(output);
+
+    // Size of the output before appending to it, or -1 when not appending.
+    off_t appendStart = -1;
+    // Offset of the input where compression starts.
+    off_t inputOffset = 0;
+    if (append && mode == MODE_COMPRESS && output > 1) {
+        struct stat outputStat;
+        unsigned char magic[6];
+        ssize_t magicSize = 0;
+        if (fstat(output, &outputStat) == 0) {
+            appendStart = outputStat.st_size;
+        }
+        if (appendStart > 0) {
+            magicSize = pread(output, magic, sizeof(magic), 0);
+        }
+        if (appendStart < 0 || (appendStart > 0 &&
+                (magicSize <= 0 || !algorithm->probe(magic, magicSize)))) {
+            printWarning("cannot append to '%s%s%s': %s",
+                    dirPath ? dirPath : "", dirPath ? "/" : "", outputName,
+                    appendStart < 0 ? strerror(errno) :
+                    "Different compression format");
+            writeFileMetrics(inputPath ? inputPath : "stdin", algorithm,
+                    level, NULL, RESULT_OPEN_FAILURE, false, NULL);
+            close(input);
+            close(output);
+            free(allocatedName);
+            return 1;
+        }
+        // Only the data added since the last time is compressed when the
+        // input is kept.
+        if (keep && input != 0 && appendStart > 0) {
+            inputOffset = getAppendOffset(input, output);
+            if (lseek(input, inputOffset, SEEK_SET) < 0) {
+                inputOffset = 0;
+            }
+        }
+    }
+
+    if (mode == MODE_COMPRESS && input != 0 && output != 1 && !force &&
+            appendStart < 0 && !checkpointPath) {
+        // The output would be discarded anyway if it is not smaller.
+        oinfo.probeSize = probeSize;
+    }
 
-    if (verbose && mode != MODE_LIST) {
+    // The progress line would overwrite the name, so it is printed later.
+    if (verbose && mode != MODE_LIST && !showProgress) {
         fprintf(stderr, "%s: ", inputPath ? inputPath : "stdin");
     }
 
+    PROBE1(file__start, inputPath ? inputPath : "stdin");
+    // The size of the input is not known when it is transcoded. Listing only
+    // reads the headers, so there is no progress to show.
+    if (showProgress && mode != MODE_LIST) {
+        startProgress(inputPath ? inputPath : "stdin", recompress ? -1 : input,
+                mode == MODE_COMPRESS);
+    }
+
     unsigned char buffer[6];
     size_t bufferUsed = 0;
     int result = RESULT_OK;
-    if (mode != MODE_COMPRESS) {
+    const struct algorithm* decoder = NULL;
+    if (mode == MODE_COMPRESS && recompress) {
+        decoder = probe(input, buffer, &bufferUsed, sizeof(buffer));
+        if (!decoder) {
+            result = bufferUsed == (size_t) -1 ? RESULT_READ_ERROR :
+                    RESULT_UNRECOGNIZED_FORMAT;
+        }
+    } else if (mode != MODE_COMPRESS) {
         if (input == 0 || writeToStdout || (suffix && !algorithm)) {
             algorithm = probe(input, buffer, &bufferUsed, sizeof(buffer));
             if (!algorithm) {
@@ -663,27 +1410,44 @@ static int processFile(int dirFd, const char* inputName, const char* outputName,
 
     struct fileinfo info = {0};
     info.oinfo = &oinfo;
+    struct memaccount* account = getThreadAccount();
+    resetMemoryPeak(account);
     if (mode == MODE_COMPRESS) {
-        if (!saveName) {
-            info.name = NULL;
-            info.modificationTime.tv_sec = 0;
-            info.modificationTime.tv_nsec = 0;
-        } else if (input == 0) {
-            info.name = NULL;
-            clock_gettime(CLOCK_REALTIME, &info.modificationTime);
-        } else {
-            info.name = inputName;
-            info.modificationTime = inputStat.st_mtim;
-        }
+        setMetadata(&info, inputName, &inputStat);
     }
     if (algorithm) {
         if (mode != MODE_COMPRESS) {
             result = algorithm->decompress(input, output, &info, buffer,
                     bufferUsed);
-        } else {
+        } else if (raced) {
+            result = copyRaceOutput(output, &info);
+        } else if (decoder) {
+            // When the input has no name field the name that decompression
+            // would produce is stored instead.
+            const char* name = info.name;
+            char* strippedName = NULL;
+            if (name) handleExtensions(name, NULL, &info.name, &strippedName);
+            result = transcode(input, output, decoder, buffer, bufferUsed,
+                    algorithm, level, &info);
+            info.name = name;
+            free(strippedName);
+        } else if (checkpointPath && inputName) {
+            result = compressCheckpointed(input, output, algorithm, level,
+                    &info, checkpointPath, &checkpointed);
+        } else if (!recompress && (inputOffset == 0 ||
+                inputOffset < inputStat.st_size)) {
             result = algorithm->compress(input, output, level, &info);
         }
     }
+    info.peakMemory = atomic_load(&account->peak);
+    PROBE4(file__end, inputPath ? inputPath : "stdin", result,
+            (int64_t) info.uncompressedSize, (int64_t) info.compressedSize);
+    if (showProgress) {
+        finishProgress(&info);
+        if (verbose && mode != MODE_LIST) {
+            fprintf(stderr, "%s: ", inputPath ? inputPath : "stdin");
+        }
+    }
 
     if (mode == MODE_DECOMPRESS && restoreName) {
         output = oinfo.outputFd;
@@ -694,39 +1458,41 @@ static int processFile(int dirFd, const char* inputName, const char* outputName,
     if (result == RESULT_OPEN_FAILURE) {
         // An error message was already printed.
         status = 1;
-    } else if (result != RESULT_OK) {
+    } else if (result != RESULT_OK && result != RESULT_ABORTED) {
         printWarning("failed to %s '%s': %s",
                 mode == MODE_COMPRESS ? "compress" :
                 mode == MODE_DECOMPRESS ? "decompress" :
                 mode == MODE_TEST ? "verify" : "list",
                 inputPath ? inputPath : "stdin",
-                result == RESULT_FORMAT_ERROR ? "file format error" :
-                result == RESULT_READ_ERROR ? "read error" :
-                result == RESULT_WRITE_ERROR ? "write error" :
-                result == RESULT_UNRECOGNIZED_FORMAT ? "unrecognized format" :
-                result == RESULT_OUT_OF_MEMORY ? "out of memory" :
-                result == RESULT_UNIMPLEMENTED_FORMAT ?
-                "file format unimplemented" : "unknown error");
+                getResultString(result));
         if (result == RESULT_OUT_OF_MEMORY) {
             // We shouldn't continue if we ran out of memory.
-            if (output != 1 && output != -1) unlinkat(dirFd, outputName, 0);
+            if (appendStart >= 0) {
+                if (ftruncate(output, appendStart) < 0) exit(1);
+            } else if (output != 1 && output != -1) {
+                unlinkat(dirFd, outputName, 0);
+            }
             exit(1);
         }
         status = 1;
-    } else if (input != 0 && output != 1 && output != -1) {
-        if (fchown(output, inputStat.st_uid, inputStat.st_gid) < 0 && !quiet) {
-            printWarning("cannot set ownership for '%s%s%s': %s",
+    } else if (input != 0 && output != 1 && output != -1 &&
+            result != RESULT_ABORTED && appendStart <= 0) {
+        bool restoreTime = restoreName && (info.modificationTime.tv_sec != 0 ||
+                info.modificationTime.tv_nsec != 0);
+        copyMetadata(output, &inputStat,
+                restoreTime ? &info.modificationTime : NULL, dirPath,
+                outputName);
+    }
+
+    if (appendStart >= 0 && status == 1) {
+        // Only remove the appended data so that the existing data is kept.
+        if (ftruncate(output, appendStart) < 0) {
+            printWarning("cannot truncate '%s%s%s': %s",
                     dirPath ? dirPath : "", dirPath ? "/" : "", outputName,
                     strerror(errno));
         }
-
-        fchmod(output, inputStat.st_mode);
-        struct timespec ts[2] = { inputStat.st_atim, inputStat.st_mtim };
-        if (restoreName && (info.modificationTime.tv_sec != 0 ||
-                info.modificationTime.tv_nsec != 0)) {
-            ts[0] = ts[1] = info.modificationTime;
-        }
-        futimens(output, ts);
+    } else if (appendStart >= 0 && keep && input != 0) {
+        saveAppendOffset(input, output, inputOffset + info.uncompressedSize);
     }
 
     if (input != 0) {
@@ -738,11 +1504,15 @@ static int processFile(int dirFd, const char* inputName, const char* outputName,
 
     double ratio = info.uncompressedSize == 0 ? -1.0 :
             1.0 - (double) info.compressedSize / (double) info.uncompressedSize;
+    if (result == RESULT_ABORTED) ratio = -1.0;
 
     if (output != 1 && output != -1 && status == 1) {
-        unlinkat(dirFd, outputName, 0);
+        // With a checkpoint the output is kept so that it can be resumed.
+        if (appendStart < 0 && !checkpointed) {
+            unlinkat(dirFd, outputName, 0);
+        }
     } else if (input != 0 && output != 1 && ratio < 0.0 && !force &&
-            mode == MODE_COMPRESS) {
+            mode == MODE_COMPRESS && appendStart < 0) {
         unlinkat(dirFd, outputName, 0);
         if (verbose) {
             fprintf(stderr, "No compression - file unchanged\n");
@@ -750,15 +1520,9 @@ static int processFile(int dirFd, const char* inputName, const char* outputName,
         status = 2;
     } else if (status == 0) {
         if (input != 0 && output != 1 && output != -1 && !keep &&
-                unlinkat(dirFd, inputName, 0) < 0 && errno == EPERM) {
-            if (!quiet || !force) {
-                printWarning("cannot unlink '%s': %s", inputPath,
-                        strerror(errno));
-            }
-            if (!force) {
-                unlinkat(dirFd, outputName, 0);
-                status = 1;
-            }
+                !unlinkInput(dirFd, inputName, inputPath)) {
+            if (appendStart < 0) unlinkat(dirFd, outputName, 0);
+            status = 1;
         } else if (mode == MODE_LIST) {
             bool nameReplaced = false;
             if (!restoreName) {
@@ -779,30 +1543,179 @@ static int processFile(int dirFd, const char* inputName, const char* outputName,
             list(&info, dirPath);
             if (nameReplaced) info.name = NULL;
         } else if (verbose) {
-            if (mode == MODE_DECOMPRESS) {
-                fprintf(stderr, "Expansion %.2f%%", ratio * 100.0);
-            } else if (mode == MODE_COMPRESS) {
-                fprintf(stderr, "Compression %.2f%%", ratio * 100.0);
-            } else if (mode == MODE_TEST) {
-                fputs("OK", stderr);
-            }
+            const char* action = NULL;
             if (output != 1 && output != -1) {
-                fprintf(stderr, " - %s '%s%s%s'",
-                        input != 0 && !keep ? "replaced with" : "created",
-                        dirPath ? dirPath : "", dirPath ? "/" : "", outputName);
+                action = appendStart >= 0 ? "appended to" :
+                        input != 0 && !keep ? "replaced with" : "created";
+            }
+            if (appendStart >= 0 && info.uncompressedSize == 0) {
+                fputs("No new data - file unchanged\n", stderr);
+            } else if (mode == MODE_TEST) {
+                fputs("OK\n", stderr);
+            } else {
+                printResult(mode == MODE_COMPRESS ? "Compression" :
+                        "Expansion", ratio, action, dirPath, outputName);
             }
-            fputc('\n', stderr);
         }
     }
+    if (measureFiles && mode != MODE_LIST) {
+        struct stats stats = {0};
+        stopStats(&stats);
+        stats.uncompressedSize = info.uncompressedSize;
+        if (showStats) {
+            printStats(inputPath ? inputPath : "stdin", &stats);
+            addStats(&totalStats, &stats);
+        }
+        writeFileMetrics(inputPath ? inputPath : "stdin", algorithm, level,
+                &info, result, status == 2, &stats);
+    }
     if (mode != MODE_COMPRESS) {
         free((void*) info.name);
     }
+    free(allocatedName);
+    return status;
+}
+
+static int processFormats(int dirFd, const char* inputName,
+        const char* inputPath, const char* dirPath) {
+    if (!inputName) {
+        printWarning("cannot write multiple formats to stdout");
+        return 1;
+    }
+    if (measureFiles) startStats();
+
+    struct stat inputStat;
+    int input = openInputFile(dirFd, inputName, inputPath, &inputStat);
+    if (input < 0) return 1;
+    if (measureFiles) trackStats(input);
+
+    if (skipIncompressible(input, &inputStat, inputPath, dirPath)) {
+        close(input);
+        return 0;
+    }
+
+    struct encoder encoders[numCandidates];
+    struct outputinfo oinfo[numCandidates];
+    char* outputNames[numCandidates];
+    size_t count = 0;
+    for (; count < numCandidates; count++) {
+        const struct algorithm* format = candidates[count].algorithm;
+        size_t extensionLength = strcspn(format->extensions, ",");
+        outputNames[count] = malloc(strlen(inputName) + extensionLength + 2);
+        if (!outputNames[count]) outOfMemory();
+        *stpncpy(stpcpy(stpcpy(outputNames[count], inputName), "."),
+                format->extensions, extensionLength) = '\0';
+
+        struct outputinfo* info = &oinfo[count];
+        info->dirFd = dirFd;
+        info->dirPath = dirPath;
+        info->outputName = outputNames[count];
+        info->probeSize = force ? 0 : probeSize;
+        info->sampleSize = 0;
+        info->smallest = NULL;
+        // The encoders run at the same time, so there is no single progress.
+        info->progress = false;
+        if (openOutputFile(outputNames[count], info) < 0) {
+            free(outputNames[count]);
+            break;
+        }
+
+        struct encoder* encoder = &encoders[count];
+        memset(encoder, 0, sizeof(*encoder));
+        encoder->algorithm = format;
+        encoder->level = candidates[count].level;
+        encoder->output = info->outputFd;
+        setMetadata(&encoder->info, inputName, &inputStat);
+        encoder->info.oinfo = info;
+    }
+
+    int status = 0;
+    if (count < numCandidates) {
+        status = 1;
+    } else {
+        int result = compressFanout(input, encoders, count);
+        if (result != RESULT_OK) {
+            printWarning("failed to compress '%s': %s", inputPath,
+                    getResultString(result));
+            status = 1;
+        }
+    }
+    close(input);
+
+    // A file that cannot be written in every format is kept.
+    for (size_t i = 0; i < count && status != 1; i++) {
+        struct fileinfo* info = &encoders[i].info;
+        int result = encoders[i].result;
+        if (result != RESULT_OK && result != RESULT_ABORTED) {
+            printWarning("failed to compress '%s': %s", inputPath,
+                    getResultString(result));
+            status = 1;
+        } else if (!force && (result == RESULT_ABORTED ||
+                info->compressedSize >= info->uncompressedSize)) {
+            status = 2;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int output = oinfo[i].outputFd;
+        if (status == 0) {
+            copyMetadata(output, &inputStat, NULL, dirPath, outputNames[i]);
+        }
+        close(output);
+        if (status != 0) unlinkat(dirFd, outputNames[i], 0);
+    }
+
+    if (status == 0 && !keep && !unlinkInput(dirFd, inputName, inputPath)) {
+        for (size_t i = 0; i < count; i++) {
+            unlinkat(dirFd, outputNames[i], 0);
+        }
+        status = 1;
+    }
+
+    if (verbose && status == 2) {
+        fprintf(stderr, "%s: No compression - file unchanged\n", inputPath);
+    } else if (verbose && status == 0) {
+        for (size_t i = 0; i < count; i++) {
+            const struct fileinfo* info = &encoders[i].info;
+            double ratio = info->uncompressedSize == 0 ? -1.0 : 1.0 -
+                    (double) info->compressedSize / info->uncompressedSize;
+            fprintf(stderr, "%s: ", inputPath);
+            printResult("Compression", ratio,
+                    keep ? "created" : "replaced with", dirPath,
+                    outputNames[i]);
+        }
+    }
+
+    if (measureFiles) {
+        struct stats stats = {0};
+        stopStats(&stats);
+        if (count > 0) {
+            stats.uncompressedSize = encoders[0].info.uncompressedSize;
+        }
+        if (showStats) {
+            printStats(inputPath, &stats);
+            addStats(&totalStats, &stats);
+        }
+        for (size_t i = 0; i < count; i++) {
+            // The output was discarded when another format failed.
+            int result = encoders[i].result;
+            if (status == 1 && result == RESULT_OK) result = RESULT_ABORTED;
+            writeFileMetrics(inputPath, encoders[i].algorithm,
+                    encoders[i].level, &encoders[i].info, result, status == 2,
+                    &stats);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(outputNames[i]);
+    }
     return status;
 }
 
 static int processOperand(const char* filename) {
     const char* inputName = filename;
     const char* outputName = NULL;
+    const char* baseName = NULL;
     char* allocatedName = NULL;
     bool isDirectory = false;
     if (strcmp(filename, "-") == 0) {
@@ -823,17 +1736,12 @@ static int processOperand(const char* filename) {
             if (givenOutputName) {
                 outputName = givenOutputName;
             } else if (!writeToStdout) {
-                const char* extension = algorithm->extensions;
-                size_t extensionLength = strcspn(extension, ",");
-                if (suffix) {
-                    extension = suffix;
-                    extensionLength = strlen(suffix);
+                // When recompressing the old extension is replaced.
+                baseName = filename;
+                if (recompress) {
+                    handleExtensions(filename, NULL, &baseName,
+                            &allocatedName);
                 }
-                allocatedName = malloc(strlen(filename) + extensionLength + 2);
-                if (!allocatedName) outOfMemory();
-                *stpncpy(stpcpy(stpcpy(allocatedName, filename), "."),
-                        extension, extensionLength) = '\0';
-                outputName = allocatedName;
             }
         } else if (!isDirectory) {
             if (writeToStdout && fileExists) {
@@ -862,20 +1770,276 @@ static int processOperand(const char* filename) {
     if (isDirectory) {
         status = processDirectory(AT_FDCWD, inputName, inputName);
     } else {
-        status = processFile(AT_FDCWD, inputName, outputName, inputName, NULL);
+        status = processFile(AT_FDCWD, inputName, outputName, baseName,
+                inputName, NULL);
     }
 
     free(allocatedName);
     return status;
 }
 
+static void raceAlgorithms(int input, const char* inputName,
+        const struct stat* inputStat) {
+    if (raceOutput >= 0) close(raceOutput);
+    raceOutput = -1;
+    raced = false;
+    algorithm = candidates[0].algorithm;
+    level = candidates[0].level;
+
+    // Each candidate compresses into a temporary file. All candidates read the
+    // input in lockstep, but a candidate that is still finishing its output
+    // gives up once it is larger than a finished one.
+    _Atomic off_t smallest = -1;
+    struct encoder encoders[numCandidates];
+    struct outputinfo oinfo[numCandidates];
+    FILE* files[numCandidates];
+    size_t count = 0;
+    for (; count < numCandidates; count++) {
+        files[count] = tmpfile();
+        if (!files[count]) break;
+
+        struct encoder* encoder = &encoders[count];
+        memset(encoder, 0, sizeof(*encoder));
+        encoder->algorithm = candidates[count].algorithm;
+        encoder->level = candidates[count].level;
+        encoder->output = fileno(files[count]);
+        encoder->smallest = &smallest;
+        setMetadata(&encoder->info, inputName, inputStat);
+        memset(&oinfo[count], 0, sizeof(oinfo[count]));
+        oinfo[count].smallest = &smallest;
+        encoder->info.oinfo = &oinfo[count];
+    }
+
+    if (count == numCandidates) {
+        raceResult = compressFanout(input, encoders, count);
+        raced = true;
+    }
+
+    size_t winner = count;
+    for (size_t i = 0; i < count && raced; i++) {
+        int result = encoders[i].result;
+        if (result == RESULT_OK) {
+            if (winner == count || encoders[i].info.compressedSize <
+                    encoders[winner].info.compressedSize) {
+                winner = i;
+            }
+        } else if (result != RESULT_ABORTED && raceResult == RESULT_OK) {
+            raceResult = result;
+        }
+    }
+    if (winner < count) {
+        if (raceResult != RESULT_READ_ERROR) raceResult = RESULT_OK;
+        algorithm = encoders[winner].algorithm;
+        level = encoders[winner].level;
+        raceInfo = encoders[winner].info;
+        // All candidates were compressed at the same time.
+        raceInfo.threads = 0;
+        for (size_t i = 0; i < count; i++) {
+            int threads = encoders[i].info.threads;
+            raceInfo.threads += threads > 0 ? threads : 1;
+        }
+        raceOutput = dup(fileno(files[winner]));
+        if (raceOutput < 0) raceResult = RESULT_WRITE_ERROR;
+    } else if (raced && raceResult == RESULT_OK) {
+        raceResult = RESULT_UNKNOWN_ERROR;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        fclose(files[i]);
+    }
+}
+
+bool reportProgress(struct fileinfo* info) {
+    struct outputinfo* oinfo = info->oinfo;
+    if (!oinfo) return true;
+    if (oinfo->progress) updateProgress(info);
+    if (oinfo->sampleSize && info->uncompressedSize >= oinfo->sampleSize) {
+        return false;
+    }
+    if (oinfo->smallest) {
+        // This output cannot become the smallest one anymore.
+        off_t smallest = atomic_load(oinfo->smallest);
+        if (smallest >= 0 && info->compressedSize > smallest) return false;
+    }
+    if (oinfo->probeSize && info->uncompressedSize >= oinfo->probeSize) {
+        // The engines buffer some data internally, so the output size lags
+        // behind the input size. Therefore a file is considered to not be
+        // compressible if it has been reduced by less than 1/32 of its size.
+        off_t threshold = info->uncompressedSize - info->uncompressedSize / 32;
+        if (info->compressedSize >= threshold) return false;
+        // The decision is only made once so that the cost of compressing
+        // the rest of the file is not wasted.
+        oinfo->probeSize = 0;
+    }
+    return true;
+}
+
+static int runBenchmark(char* files[], int numFiles, char* algorithmNames,
+        int lastLevel) {
+    const struct algorithm* selected[sizeof(algorithms) /
+            sizeof(algorithms[0])];
+    size_t numSelected = 0;
+    if (!algorithmNames) {
+        for (size_t i = 0; algorithms[i]; i++) {
+            selected[numSelected++] = algorithms[i];
+        }
+    } else {
+        for (char* name = strtok(algorithmNames, ","); name;
+                name = strtok(NULL, ",")) {
+            const struct algorithm* algo = getAlgorithm(name);
+            if (!algo) {
+                printWarning("unknown compression algorithm '%s'", name);
+                return 3;
+            }
+            bool duplicate = false;
+            for (size_t i = 0; i < numSelected; i++) {
+                if (selected[i] == algo) duplicate = true;
+            }
+            if (!duplicate) selected[numSelected++] = algo;
+        }
+    }
+    selected[numSelected] = NULL;
+    if (lastLevel == -1) lastLevel = level;
+
+    if (!quiet && benchmarkCsv) {
+        puts("algorithm,level,size,compressed_size,ratio,compress_mb_s,"
+                "decompress_mb_s,peak_memory,name");
+    } else if (!quiet) {
+        puts("algorithm level   ratio  comp MB/s   dec MB/s   peak KiB  name");
+    }
+
+    int status = 0;
+    for (int i = 0; i < numFiles || (i == 0 && numFiles == 0); i++) {
+        const char* filename = numFiles == 0 ? "-" : files[i];
+        int input = 0;
+        if (strcmp(filename, "-") != 0) {
+            input = open(filename, O_RDONLY);
+            if (input < 0) {
+                printWarning("cannot open '%s': %s", filename,
+                        strerror(errno));
+                status = 1;
+                continue;
+            }
+        }
+
+        int result = benchmarkFile(input, input == 0 ? "stdin" : filename,
+                selected, level, lastLevel, benchmarkCsv);
+        if (input != 0) close(input);
+        if (result != RESULT_OK) {
+            printWarning("failed to benchmark '%s': %s",
+                    input == 0 ? "stdin" : filename, getResultString(result));
+            status = 1;
+        }
+    }
+    return status;
+}
+
+static void selectAlgorithm(int dirFd, const char* inputName) {
+    size_t count;
+    const struct calibration* reference = getCalibration(&count, false);
+
+    // Estimate how well the input compresses by compressing its beginning
+    // with the reference algorithm.
+    double sampleRatio = 0;
+    int fd = inputName ? openat(dirFd, inputName, O_RDONLY | O_NOFOLLOW) : -1;
+    if (fd >= 0) {
+        struct outputinfo oinfo = {0};
+        oinfo.sampleSize = SAMPLE_SIZE;
+        struct fileinfo info = {0};
+        info.oinfo = &oinfo;
+        int result = reference->algorithm->compress(fd, -1, reference->level,
+                &info);
+        if ((result == RESULT_OK || result == RESULT_ABORTED) &&
+                info.uncompressedSize > 0) {
+            sampleRatio = (double) info.compressedSize / info.uncompressedSize;
+        }
+        close(fd);
+    }
+
+    // The default speed only affects the selection. Setting targetSpeed would
+    // also make the engines adjust their level.
+    uint64_t speed = targetSpeed;
+    if (!speed && !targetRatio) speed = DEFAULT_TARGET_SPEED;
+    const struct calibration* choice = chooseConfiguration(sampleRatio,
+            speed, targetRatio);
+    algorithm = choice->algorithm;
+    level = choice->level;
+}
+
+static void setMetadata(struct fileinfo* info, const char* inputName,
+        const struct stat* inputStat) {
+    if (!saveName) {
+        info->name = NULL;
+        info->modificationTime.tv_sec = 0;
+        info->modificationTime.tv_nsec = 0;
+    } else if (!inputName) {
+        info->name = NULL;
+        clock_gettime(CLOCK_REALTIME, &info->modificationTime);
+    } else {
+        info->name = inputName;
+        info->modificationTime = inputStat->st_mtim;
+    }
+}
+
+static bool skipIncompressible(int input, const struct stat* inputStat,
+        const char* inputPath, const char* dirPath) {
+    // Don't waste time on compressed or encrypted files when recursively
+    // compressing directories.
+    if (!dirPath || writeToStdout || force || recompress ||
+            !isIncompressible(input, inputStat->st_size)) {
+        return false;
+    }
+    if (verbose) {
+        fprintf(stderr, "%s: Incompressible - file unchanged\n", inputPath);
+    }
+    return true;
+}
+
+static bool unlinkInput(int dirFd, const char* inputName,
+        const char* inputPath) {
+    if (unlinkat(dirFd, inputName, 0) == 0 || errno != EPERM) return true;
+    if (!quiet || !force) {
+        printWarning("cannot unlink '%s': %s", inputPath, strerror(errno));
+    }
+    // The outputs are only kept without the input when forced.
+    return force;
+}
+
 ssize_t writeAll(int fd, const void* buffer, size_t size) {
+    PROBE2(write, fd, size);
     if (fd == -1) return size;
     size_t written = 0;
     while (written < size) {
-        ssize_t result = write(fd, (char*) buffer + written, size - written);
+        ssize_t result = writeOutput(fd, (char*) buffer + written,
+                size - written);
         if (result < 0) return -1;
         written += result;
     }
     return written;
 }
+
+static void writeFileMetrics(const char* path,
+        const struct algorithm* algorithm, int level,
+        const struct fileinfo* info, int result, bool skipped,
+        const struct stats* stats) {
+    if (metricsFd < 0 || mode == MODE_LIST) return;
+    static const struct stats noStats;
+    struct metrics metrics = {0};
+    metrics.path = path;
+    metrics.mode = mode == MODE_COMPRESS ? "compress" :
+            mode == MODE_DECOMPRESS ? "decompress" : "test";
+    metrics.algorithm = algorithm;
+    metrics.level = mode == MODE_COMPRESS ? level : -1;
+    metrics.threads = info && info->threads > 0 ? info->threads : 1;
+    if (info && mode == MODE_COMPRESS) {
+        metrics.inputSize = info->uncompressedSize;
+        metrics.outputSize = info->compressedSize;
+    } else if (info) {
+        metrics.inputSize = info->compressedSize;
+        metrics.outputSize = info->uncompressedSize;
+    }
+    metrics.result = result;
+    metrics.skipped = skipped;
+    metrics.stats = stats ? stats : &noStats;
+    writeMetrics(metricsFd, &metrics);
+}
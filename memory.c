@@ -0,0 +1,192 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* memory.c
+ * Memory allocation and accounting.
+ */
+
+#include <config.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "algorithm.h"
+
+#if defined(MADV_HUGEPAGE) && defined(MAP_ANONYMOUS)
+#  define HAVE_HUGE_PAGES 1
+#  define HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+#endif
+
+// Every allocation is preceded by a header that remembers the requested size
+// and the account that the allocation was charged to, so that memory can be
+// freed from any thread.
+struct header {
+    struct memaccount* account;
+    size_t size;
+    bool mapped;
+};
+
+#define HEADER_SIZE ((sizeof(struct header) + _Alignof(max_align_t) - 1) & \
+        ~(_Alignof(max_align_t) - 1))
+
+uint64_t memoryLimit = 0;
+struct memaccount processMemory;
+static _Thread_local struct memaccount threadMemory;
+
+static void charge(struct memaccount* account, size_t size) {
+    size_t current = atomic_fetch_add(&account->current, size) + size;
+    size_t peak = atomic_load(&account->peak);
+    while (current > peak &&
+            !atomic_compare_exchange_weak(&account->peak, &peak, current));
+}
+
+#if HAVE_HUGE_PAGES
+static bool hugePagesEnabled(void) {
+    // 0 = unknown, 1 = disabled, 2 = enabled
+    static atomic_int state;
+
+    int result = atomic_load(&state);
+    if (result == 0) {
+        result = 1;
+        int fd = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY);
+        if (fd >= 0) {
+            char buffer[64];
+            ssize_t size = read(fd, buffer, sizeof(buffer) - 1);
+            if (size > 0) {
+                buffer[size] = '\0';
+                if (!strstr(buffer, "[never]")) result = 2;
+            }
+            close(fd);
+        }
+        atomic_store(&state, result);
+    }
+    return result == 2;
+}
+
+static size_t getMappedSize(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+// Returns the start of the normal page that contains the header.
+static char* getMappingStart(struct header* header) {
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    return (char*) ((uintptr_t) header & ~(pageSize - 1));
+}
+
+// Map memory aligned to the huge page size so that the kernel can back it with
+// transparent huge pages. This reduces TLB misses for large tables that are
+// accessed randomly. The header is stored in the normal page before the
+// aligned region, so that an allocation of a multiple of the huge page size
+// does not need another huge page for it.
+static struct header* mapHugePages(size_t size) {
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - 2 * HUGE_PAGE_SIZE - pageSize) return NULL;
+    size_t mappedSize = getMappedSize(size);
+    // An aligned region preceded by the header fits into this mapping.
+    size_t totalSize = mappedSize + HUGE_PAGE_SIZE + pageSize;
+    char* mapping = mmap(NULL, totalSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return NULL;
+
+    uintptr_t address = (uintptr_t) mapping + HEADER_SIZE;
+    char* data = mapping + HEADER_SIZE + (-address & (HUGE_PAGE_SIZE - 1));
+    struct header* header = (struct header*) (data - HEADER_SIZE);
+
+    // Unmap the parts before the header page and after the aligned region.
+    char* start = getMappingStart(header);
+    if (start != mapping) munmap(mapping, start - mapping);
+    char* end = data + mappedSize;
+    if (end != mapping + totalSize) {
+        munmap(end, mapping + totalSize - end);
+    }
+
+    madvise(data, mappedSize, MADV_HUGEPAGE);
+    // Like with malloc the requested size is charged, not the mapped size.
+    header->size = size;
+    header->mapped = true;
+    return header;
+}
+#endif
+
+static void* allocate(struct memaccount* account, size_t size, bool huge) {
+    if (size > SIZE_MAX - HEADER_SIZE) return NULL;
+    struct header* header = NULL;
+
+#if HAVE_HUGE_PAGES
+    // Smaller allocations would waste most of the huge page unless the caller
+    // asked for it.
+    if ((huge || size >= HUGE_PAGE_SIZE) && hugePagesEnabled()) {
+        header = mapHugePages(size);
+    }
+#else
+    (void) huge;
+#endif
+
+    if (!header) {
+        header = malloc(HEADER_SIZE + size);
+        if (!header) return NULL;
+        header->size = size;
+        header->mapped = false;
+    }
+    header->account = account;
+    charge(account, header->size);
+    charge(&processMemory, header->size);
+    return (char*) header + HEADER_SIZE;
+}
+
+void* allocateLargeMemory(struct memaccount* account, size_t size) {
+    return allocate(account, size, true);
+}
+
+void* allocateMemory(struct memaccount* account, size_t size) {
+    return allocate(account, size, false);
+}
+
+void freeMemory(void* ptr) {
+    if (!ptr) return;
+    struct header* header = (struct header*) ((char*) ptr - HEADER_SIZE);
+    atomic_fetch_sub(&header->account->current, header->size);
+    atomic_fetch_sub(&processMemory.current, header->size);
+#if HAVE_HUGE_PAGES
+    if (header->mapped) {
+        char* start = getMappingStart(header);
+        munmap(start, (char*) ptr + getMappedSize(header->size) - start);
+        return;
+    }
+#endif
+    free(header);
+}
+
+struct memaccount* getThreadAccount(void) {
+    return &threadMemory;
+}
+
+uint64_t getMemoryBudget(void) {
+    if (memoryLimit == 0) return UINT64_MAX;
+
+    // Memory already owned by the calling thread is likely to be reused by the
+    // new job and therefore does not reduce the budget.
+    size_t total = atomic_load(&processMemory.current);
+    size_t own = atomic_load(&threadMemory.current);
+    size_t used = total > own ? total - own : 0;
+    return used < memoryLimit ? memoryLimit - used : 0;
+}
+
+void resetMemoryPeak(struct memaccount* account) {
+    atomic_store(&account->peak, atomic_load(&account->current));
+}
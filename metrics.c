@@ -0,0 +1,93 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* metrics.c
+ * JSON records of processed files for --metrics-json.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "algorithm.h"
+
+static const char* resultNames[] = {
+    [RESULT_OK] = "ok",
+    [RESULT_READ_ERROR] = "read_error",
+    [RESULT_WRITE_ERROR] = "write_error",
+    [RESULT_FORMAT_ERROR] = "format_error",
+    [RESULT_UNRECOGNIZED_FORMAT] = "unrecognized_format",
+    [RESULT_UNIMPLEMENTED_FORMAT] = "unimplemented_format",
+    [RESULT_OUT_OF_MEMORY] = "out_of_memory",
+    [RESULT_OPEN_FAILURE] = "open_failure",
+    [RESULT_ABORTED] = "aborted",
+    [RESULT_UNKNOWN_ERROR] = "unknown_error",
+};
+
+void writeJsonString(FILE* file, const char* string) {
+    putc('"', file);
+    for (const unsigned char* s = (const unsigned char*) string; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(file, "\\%c", *s);
+        } else if (*s < 0x20 || *s == 0x7F) {
+            fprintf(file, "\\u%04x", *s);
+        } else {
+            putc(*s, file);
+        }
+    }
+    putc('"', file);
+}
+
+void writeMetrics(int fd, const struct metrics* metrics) {
+    // Each record is written with a single write so that records of processes
+    // sharing the file are not interleaved.
+    char* line;
+    size_t length;
+    FILE* file = open_memstream(&line, &length);
+    if (!file) return;
+
+    fputs("{\"path\": ", file);
+    writeJsonString(file, metrics->path);
+    fprintf(file, ", \"mode\": \"%s\", \"algorithm\": ", metrics->mode);
+    if (metrics->algorithm && metrics->algorithm->names) {
+        size_t nameLength = strcspn(metrics->algorithm->names, ",");
+        fprintf(file, "\"%.*s\"", (int) nameLength, metrics->algorithm->names);
+    } else {
+        fputs("null", file);
+    }
+    fputs(", \"level\": ", file);
+    if (metrics->level >= 0) {
+        fprintf(file, "%d", metrics->level);
+    } else {
+        fputs("null", file);
+    }
+
+    double ratio = metrics->inputSize > 0 ?
+            (double) metrics->outputSize / metrics->inputSize : 0.0;
+    const struct stats* stats = metrics->stats;
+    fprintf(file, ", \"input_size\": %jd, \"output_size\": %jd, "
+            "\"ratio\": %.6f, \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, "
+            "\"read_wait_seconds\": %.6f, \"write_wait_seconds\": %.6f, "
+            "\"threads\": %d, \"result\": \"%s\", \"skipped\": %s}\n",
+            (intmax_t) metrics->inputSize, (intmax_t) metrics->outputSize,
+            ratio, stats->wallTime, stats->cpuTime, stats->readWait,
+            stats->writeWait, metrics->threads, resultNames[metrics->result],
+            metrics->skipped ? "true" : "false");
+
+    if (fclose(file) == 0) {
+        writeAll(fd, line, length);
+    }
+    free(line);
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* parallel.c
+ * Helpers for compressing blocks in parallel.
+ */
+
+#include <config.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "algorithm.h"
+
+size_t getThreadCount(uint64_t memoryPerThread) {
+    long threads = maxThreads;
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads <= 0) threads = 1;
+    }
+
+    uint64_t memoryAvailable = getMemoryBudget();
+    while (threads > 1 && (uint64_t) threads * memoryPerThread >
+            memoryAvailable) {
+        threads--;
+    }
+    return threads;
+}
+
+struct task {
+    void* (*function)(void*);
+    void* item;
+};
+
+static void* runTask(void* arg) {
+    struct task* task = arg;
+    uint64_t start = traceTime();
+    task->function(task->item);
+    traceBlock(start);
+    return NULL;
+}
+
+void runParallel(void* (*function)(void*), void* items, size_t itemSize,
+        size_t count) {
+    if (count == 0) return;
+    char* item = items;
+    struct task tasks[count];
+    for (size_t i = 0; i < count; i++) {
+        tasks[i].function = function;
+        tasks[i].item = item + i * itemSize;
+    }
+
+    // The calling thread handles the first item itself. If a thread cannot be
+    // created its item is handled afterwards.
+    pthread_t threads[count];
+    bool created[count];
+    for (size_t i = 1; i < count; i++) {
+        created[i] = pthread_create(&threads[i], NULL, runTask,
+                &tasks[i]) == 0;
+    }
+    runTask(&tasks[0]);
+    for (size_t i = 1; i < count; i++) {
+        if (created[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            runTask(&tasks[i]);
+        }
+    }
+}
@@ -0,0 +1,158 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* progress.c
+ * Live progress of the file being processed for --progress.
+ */
+
+#include <config.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "algorithm.h"
+
+// On a terminal the line is redrawn at most this often. Otherwise a new line
+// is printed at this interval so that logs do not fill up.
+#define TERMINAL_INTERVAL UINT64_C(250000000)
+#define LINE_INTERVAL UINT64_C(10000000000)
+
+static const char* name;
+static bool compressing;
+static bool terminal;
+// Number of input bytes, or -1 if unknown.
+static off_t totalSize;
+static off_t uncompressedOffset;
+static off_t compressedOffset;
+static uint64_t startTime;
+static uint64_t lastTime;
+static off_t lastProcessed;
+static double currentSpeed;
+static int lineLength;
+
+static uint64_t getNanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * UINT64_C(1000000000) + now.tv_nsec;
+}
+
+static void formatSize(char* buffer, size_t size, double bytes) {
+    static const char* units[] = { "B", "kB", "MB", "GB", "TB", "PB" };
+    size_t unit = 0;
+    while (bytes >= 1000 && unit < sizeof(units) / sizeof(units[0]) - 1) {
+        bytes /= 1000;
+        unit++;
+    }
+    snprintf(buffer, size, unit == 0 ? "%.0f %s" : "%.1f %s", bytes,
+            units[unit]);
+}
+
+static void printProgress(off_t uncompressed, off_t compressed, uint64_t now,
+        bool final) {
+    off_t processed = compressing ? uncompressed : compressed;
+    double elapsed = (now - startTime) / 1e9;
+    double averageSpeed = elapsed > 0 ? processed / elapsed : 0.0;
+    if (now > lastTime) {
+        currentSpeed = (processed - lastProcessed) / ((now - lastTime) / 1e9);
+    }
+    lastTime = now;
+    lastProcessed = processed;
+
+    char line[256];
+    char sizeString[32];
+    char speedString[32];
+    char averageString[32];
+    formatSize(sizeString, sizeof(sizeString), processed);
+    formatSize(speedString, sizeof(speedString), currentSpeed);
+    formatSize(averageString, sizeof(averageString), averageSpeed);
+    int length = snprintf(line, sizeof(line), "%s: %s", name, sizeString);
+    if (totalSize >= 0 && length < (int) sizeof(line)) {
+        char totalString[32];
+        formatSize(totalString, sizeof(totalString), totalSize);
+        double percent = totalSize > 0 ? 100.0 * processed / totalSize : 100.0;
+        if (percent > 100.0) percent = 100.0;
+        length += snprintf(line + length, sizeof(line) - length,
+                " of %s (%.1f%%)", totalString, percent);
+    }
+    if (length < (int) sizeof(line)) {
+        length += snprintf(line + length, sizeof(line) - length,
+                ", %s/s, average %s/s", speedString, averageString);
+    }
+    if (uncompressed > 0 && length < (int) sizeof(line)) {
+        length += snprintf(line + length, sizeof(line) - length,
+                ", ratio %.2f", (double) compressed / uncompressed);
+    }
+    if (!final && totalSize > processed && averageSpeed > 0 &&
+            length < (int) sizeof(line)) {
+        uint64_t eta = (totalSize - processed) / averageSpeed;
+        length += snprintf(line + length, sizeof(line) - length,
+                ", ETA %" PRIu64 ":%02u:%02u", eta / 3600,
+                (unsigned int) (eta / 60 % 60), (unsigned int) (eta % 60));
+    }
+    if (length >= (int) sizeof(line)) length = sizeof(line) - 1;
+
+    if (terminal) {
+        // Spaces erase the rest of a longer previous line.
+        int padding = lineLength > length ? lineLength - length : 0;
+        fprintf(stderr, "\r%s%*s", line, padding, "");
+        if (final) fputc('\n', stderr);
+        lineLength = final ? 0 : length;
+    } else {
+        fprintf(stderr, "%s\n", line);
+    }
+}
+
+void finishProgress(const struct fileinfo* info) {
+    if (!name) return;
+    printProgress(info->uncompressedSize, info->compressedSize,
+            getNanoseconds(), true);
+    name = NULL;
+}
+
+void setProgressOffset(off_t uncompressedSize, off_t compressedSize) {
+    uncompressedOffset = uncompressedSize;
+    compressedOffset = compressedSize;
+}
+
+void startProgress(const char* path, int input, bool compress) {
+    name = path;
+    compressing = compress;
+    terminal = isatty(2);
+    totalSize = -1;
+    struct stat inputStat;
+    if (input >= 0 && fstat(input, &inputStat) == 0 &&
+            S_ISREG(inputStat.st_mode)) {
+        // Only the rest of the input is processed when resuming.
+        off_t offset = lseek(input, 0, SEEK_CUR);
+        totalSize = inputStat.st_size - (offset > 0 ? offset : 0);
+        if (totalSize < 0) totalSize = 0;
+    }
+    uncompressedOffset = 0;
+    compressedOffset = 0;
+    startTime = lastTime = getNanoseconds();
+    lastProcessed = 0;
+    currentSpeed = 0;
+    lineLength = 0;
+}
+
+void updateProgress(const struct fileinfo* info) {
+    if (!name) return;
+    uint64_t now = getNanoseconds();
+    if (now - lastTime < (terminal ? TERMINAL_INTERVAL : LINE_INTERVAL)) {
+        return;
+    }
+    printProgress(uncompressedOffset + info->uncompressedSize,
+            compressedOffset + info->compressedSize, now, false);
+}
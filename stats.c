@@ -0,0 +1,194 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* stats.c
+ * Measurement of time and I/O for --stats and --trace.
+ */
+
+#include <config.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "algorithm.h"
+
+// File descriptors above this limit are never measured.
+#define MAX_TRACKED_FDS 1024
+
+struct counter {
+    atomic_uint_fast64_t calls;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t nanoseconds;
+};
+
+// Only I/O on the input and output files is measured, not on the pipes that
+// connect threads.
+static atomic_bool tracked[MAX_TRACKED_FDS];
+static struct counter reads;
+static struct counter writes;
+static uint64_t startTime;
+static double startCpuTime;
+// The thread that runs the codec. Its I/O waits are only accessed by itself.
+static pthread_t codecThread;
+static uint64_t codecWait;
+
+static uint64_t getNanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * UINT64_C(1000000000) + now.tv_nsec;
+}
+
+static double getCpuTime(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) return 0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static long getPeakRss(void) {
+    long peak = -1;
+    FILE* file = fopen("/proc/self/status", "r");
+    if (file) {
+        char line[256];
+        while (peak < 0 && fgets(line, sizeof(line), file)) {
+            if (sscanf(line, "VmHWM: %ld", &peak) != 1) peak = -1;
+        }
+        fclose(file);
+    }
+    if (peak < 0) {
+        struct rusage usage;
+        peak = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+    }
+    return peak;
+}
+
+static bool resetPeakRss(void) {
+    // Linux allows resetting the peak so that it can be measured per file.
+    // Otherwise the peak of the whole process is reported.
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool result = write(fd, "5", 1) == 1;
+    close(fd);
+    return result;
+}
+
+static bool isTracked(int fd) {
+    return fd >= 0 && fd < MAX_TRACKED_FDS && atomic_load(&tracked[fd]);
+}
+
+static void count(struct counter* counter, ssize_t result, uint64_t start) {
+    uint64_t time = getNanoseconds() - start;
+    atomic_fetch_add(&counter->calls, 1);
+    if (result > 0) atomic_fetch_add(&counter->bytes, result);
+    atomic_fetch_add(&counter->nanoseconds, time);
+    // Waits of helper threads overlap with the codec and are not subtracted.
+    if (pthread_equal(pthread_self(), codecThread)) codecWait += time;
+}
+
+void addStats(struct stats* total, const struct stats* stats) {
+    total->wallTime += stats->wallTime;
+    total->cpuTime += stats->cpuTime;
+    total->readWait += stats->readWait;
+    total->writeWait += stats->writeWait;
+    total->codecTime += stats->codecTime;
+    total->readCalls += stats->readCalls;
+    total->readBytes += stats->readBytes;
+    total->writeCalls += stats->writeCalls;
+    total->writeBytes += stats->writeBytes;
+    total->uncompressedSize += stats->uncompressedSize;
+    if (stats->peakRss > total->peakRss) total->peakRss = stats->peakRss;
+    total->files++;
+}
+
+void printStats(const char* name, const struct stats* stats) {
+    double speed = stats->wallTime > 0 ?
+            stats->uncompressedSize / stats->wallTime / 1e6 : 0.0;
+
+    fprintf(stderr, "%s: %" PRIu64 " bytes in, %" PRIu64 " bytes out, "
+            "%.2f MB/s\n", name, stats->readBytes, stats->writeBytes, speed);
+    fprintf(stderr, "  time: %.3f s wall, %.3f s CPU, %.3f s codec\n",
+            stats->wallTime, stats->cpuTime, stats->codecTime);
+    fprintf(stderr, "  reads: %" PRIu64 " calls, %.0f bytes average, "
+            "%.3f s wait\n", stats->readCalls, stats->readCalls ?
+            (double) stats->readBytes / stats->readCalls : 0.0,
+            stats->readWait);
+    fprintf(stderr, "  writes: %" PRIu64 " calls, %.0f bytes average, "
+            "%.3f s wait\n", stats->writeCalls, stats->writeCalls ?
+            (double) stats->writeBytes / stats->writeCalls : 0.0,
+            stats->writeWait);
+    fprintf(stderr, "  peak RSS: %ld KiB\n", stats->peakRss);
+}
+
+ssize_t readInput(int fd, void* buffer, size_t size) {
+    bool tracked = isTracked(fd);
+    if (!tracked && !tracing) return read(fd, buffer, size);
+    uint64_t start = getNanoseconds();
+    ssize_t result = read(fd, buffer, size);
+    if (tracked) count(&reads, result, start);
+    if (tracing) traceIo("read", start, result);
+    return result;
+}
+
+void startStats(void) {
+    for (size_t i = 0; i < MAX_TRACKED_FDS; i++) {
+        atomic_store(&tracked[i], false);
+    }
+    struct counter* counters[] = { &reads, &writes };
+    for (size_t i = 0; i < 2; i++) {
+        atomic_store(&counters[i]->calls, 0);
+        atomic_store(&counters[i]->bytes, 0);
+        atomic_store(&counters[i]->nanoseconds, 0);
+    }
+    codecThread = pthread_self();
+    codecWait = 0;
+    resetPeakRss();
+    startCpuTime = getCpuTime();
+    startTime = getNanoseconds();
+}
+
+void stopStats(struct stats* stats) {
+    stats->wallTime = (getNanoseconds() - startTime) / 1e9;
+    stats->cpuTime = getCpuTime() - startCpuTime;
+    stats->readWait = atomic_load(&reads.nanoseconds) / 1e9;
+    stats->writeWait = atomic_load(&writes.nanoseconds) / 1e9;
+    // Whatever time the codec thread did not spend waiting for I/O was spent
+    // in the codec.
+    stats->codecTime = stats->wallTime - codecWait / 1e9;
+    if (stats->codecTime < 0) stats->codecTime = 0;
+    stats->readCalls = atomic_load(&reads.calls);
+    stats->readBytes = atomic_load(&reads.bytes);
+    stats->writeCalls = atomic_load(&writes.calls);
+    stats->writeBytes = atomic_load(&writes.bytes);
+    stats->peakRss = getPeakRss();
+    for (size_t i = 0; i < MAX_TRACKED_FDS; i++) {
+        atomic_store(&tracked[i], false);
+    }
+}
+
+void trackStats(int fd) {
+    if (fd >= 0 && fd < MAX_TRACKED_FDS) atomic_store(&tracked[fd], true);
+}
+
+ssize_t writeOutput(int fd, const void* buffer, size_t size) {
+    bool tracked = isTracked(fd);
+    if (!tracked && !tracing) return write(fd, buffer, size);
+    uint64_t start = getNanoseconds();
+    ssize_t result = write(fd, buffer, size);
+    if (tracked) count(&writes, result, start);
+    if (tracing) traceIo("write", start, result);
+    return result;
+}
@@ -1,5 +1,5 @@
 #! /bin/sh
-# Copyright (c) 2020, 2022, 2024 Dennis Wölfing
+# Copyright (c) 2020, 2022, 2024, 2026 Dennis Wölfing
 #
 # Permission to use, copy, modify, and/or distribute this software for any
 # purpose with or without fee is hereby granted, provided that the above
@@ -494,6 +494,445 @@ do
 done
 rm -f compare
 
+# Check bzip2 compression if it is supported
+if compress -m bzip2 -c < /dev/null > /dev/null 2>&1; then
+    compressibleFile > compare
+    for options in "-b 1" "-b 9" "-T 1" "-T 4"
+    do
+        compressibleFile > foo
+        compress -m bzip2 $options foo || fail $LINENO "Compression with $options failed"
+        test ! -e foo || fail $LINENO "Input file was not unlinked"
+        test -e foo.bz2 || fail $LINENO "Output file was not created"
+
+        compress -d $options foo.bz2 || fail $LINENO "Decompression for $options failed"
+        test -e foo || fail $LINENO "Output file was not created"
+        test ! -e foo.bz2 || fail $LINENO "Input file was not unlinked"
+
+        cmp -s foo compare || fail $LINENO "Decompressed file contents for $options are incorrect"
+        rm -f foo foo.bz2
+    done
+
+    # Concatenated streams must be decompressed as a whole.
+    compressibleFile | compress -m bzip2 -c > foo.bz2
+    compressibleFile | compress -m bzip2 -c >> foo.bz2
+    compressibleFile >> compare
+    compress -d -T 4 foo.bz2 || fail $LINENO "Decompression of concatenated streams failed"
+    cmp -s foo compare || fail $LINENO "Decompressed file contents are incorrect"
+    rm -f foo foo.bz2 compare
+
+    # A single stream with three blocks that are not byte aligned, as created
+    # by bzip2 -1.
+    printf '\102\132\150\061\061\101\131\046\123\131\361\113\213\047\000\141' > foo.bz2
+    printf '\243\001\000\060\000\040\000\060\200\051\031\102\120\132\241\050' >> foo.bz2
+    printf '\056\142\202\262\114\246\262\003\175\274\370\000\303\106\002\000' >> foo.bz2
+    printf '\140\000\100\000\141\000\122\065\102\120\131\102\120\134\305\005' >> foo.bz2
+    printf '\144\231\115\147\305\056\054\234\001\206\214\004\000\300\000\200' >> foo.bz2
+    printf '\000\302\000\244\145\011\101\152\204\240\271\212\012\311\062\232' >> foo.bz2
+    printf '\316\154\176\024\070\000\000\160\010\001\200\001\000\001\204\002' >> foo.bz2
+    printf '\152\062\065\034\135\311\024\341\102\102\216\377\320\034' >> foo.bz2
+    awk 'BEGIN { for (i = 0; i < 150000; i++) printf "ab" }' > compare
+    for options in "-T 1" "-T 4"
+    do
+        compress -d $options -c foo.bz2 > foo || fail $LINENO "Decompression of blocks with $options failed"
+        cmp -s foo compare || fail $LINENO "Decompressed file contents for $options are incorrect"
+    done
+    rm -f foo foo.bz2 compare
+fi
+
+# Check lz4 compression if it is supported
+if compress -m lz4 -c < /dev/null > /dev/null 2>&1; then
+    compressibleFile > compare
+    for options in "-b 1" "-b 3" "-b 12" "-T 4"
+    do
+        compressibleFile > foo
+        compress -m lz4 $options foo || fail $LINENO "Compression with $options failed"
+        test ! -e foo || fail $LINENO "Input file was not unlinked"
+        test -e foo.lz4 || fail $LINENO "Output file was not created"
+
+        compress -d foo.lz4 || fail $LINENO "Decompression for $options failed"
+        test -e foo || fail $LINENO "Output file was not created"
+        test ! -e foo.lz4 || fail $LINENO "Input file was not unlinked"
+
+        cmp -s foo compare || fail $LINENO "Decompressed file contents for $options are incorrect"
+        rm -f foo foo.lz4
+    done
+    rm -f compare
+
+    # A header that claims an impossible content size is not trusted.
+    printf '\004\042\115\030\150\160\000\000\000\000\000\001\000\000\227\000\000\000\000' > foo.lz4
+    (ulimit -f 100; compress -d foo.lz4) 2>/dev/null
+    test $? = 1 || fail $LINENO "Output was preallocated for an invalid header"
+    rm -f foo foo.lz4
+fi
+
+# Check zstd compression if it is supported
+if compress -m zstd -c < /dev/null > /dev/null 2>&1; then
+    compressibleFile > compare
+    for options in "-b 1" "-b 3" "-b 19" "--ultra -b 22" "-T 4" "--long"
+    do
+        compressibleFile > foo
+        compress -m zstd $options foo || fail $LINENO "Compression with $options failed"
+        test ! -e foo || fail $LINENO "Input file was not unlinked"
+        test -e foo.zst || fail $LINENO "Output file was not created"
+
+        compress -d foo.zst || fail $LINENO "Decompression for $options failed"
+        test -e foo || fail $LINENO "Output file was not created"
+        test ! -e foo.zst || fail $LINENO "Input file was not unlinked"
+
+        cmp -s foo compare || fail $LINENO "Decompressed file contents for $options are incorrect"
+        rm -f foo foo.zst
+    done
+    compressibleFile > foo
+    compress -m zstd -b 22 foo 2>/dev/null && fail $LINENO "Level 22 was accepted without --ultra"
+
+    # The memory of libzstd must be accounted like that of the other engines.
+    compress -m zstd -b 19 -T 4 --memory-limit=1M foo || fail $LINENO "Compression with --memory-limit failed"
+    compress -d foo.zst || fail $LINENO "Decompression failed"
+    cmp -s foo compare || fail $LINENO "Decompressed file contents are incorrect"
+    peak=$(compress --benchmark=csv -m zstd foo | tail -n 1 | cut -d, -f8)
+    test "$peak" -gt 0 || fail $LINENO "Memory used by zstd was not measured"
+    rm -f foo foo.zst compare
+fi
+
+# Check that a low memory limit does not cause compression to fail
+compressibleFile > compare
+compressibleFile > foo
+compress -m xz -9 -T 4 --memory-limit=1M foo || fail $LINENO "Compression with --memory-limit failed"
+compress -d foo.xz || fail $LINENO "Decompression failed"
+cmp -s foo compare || fail $LINENO "Decompressed file contents are incorrect"
+rm -f foo foo.xz compare
+
+# Check automatic algorithm selection
+compressibleFile > compare
+for options in "" "--target-speed=1K/s" "--target-ratio=2" "--target-speed=1GiB/s"
+do
+    compressibleFile > foo
+    XDG_CACHE_HOME="$PWD/cache" compress -m auto $options foo || fail $LINENO "Compression with $options failed"
+    test ! -e foo || fail $LINENO "Input file was not unlinked"
+    compress -d foo.* || fail $LINENO "Decompression with $options failed"
+    cmp -s foo compare || fail $LINENO "Decompressed file contents are incorrect"
+    rm -f foo
+done
+test -s cache/dxcompress/calibration || fail $LINENO "Calibration profile was not saved"
+compress -m auto --target-ratio=0 -c < compare > /dev/null 2>&1 && fail $LINENO "Invalid target ratio was accepted"
+
+# Files with the extension of any algorithm are skipped when recursing.
+mkdir dir
+compressibleFile > dir/foo
+compressibleFile > dir/bar.gz
+compressibleFile > dir/baz.Z
+XDG_CACHE_HOME="$PWD/cache" compress -m auto -r dir || fail $LINENO "Recursive compression failed"
+test ! -e dir/foo || fail $LINENO "Input file was not unlinked"
+cmp -s dir/bar.gz compare || fail $LINENO "File with .gz extension was compressed"
+cmp -s dir/baz.Z compare || fail $LINENO "File with .Z extension was compressed"
+test "$(ls dir | wc -l)" -eq 3 || fail $LINENO "Unexpected files were created"
+rm -rf dir
+
+# Without a target speed the selected level is not adjusted.
+awk 'BEGIN { for (i = 0; i < 1000000; i++) print i }' > foo
+XDG_CACHE_HOME="$PWD/cache" compress -m auto -k --metrics-json=metrics foo || fail $LINENO "Compression failed"
+algo=$(sed 's/.*"algorithm": "\([^"]*\)".*/\1/' metrics)
+level=$(sed 's/.*"level": \([0-9]*\).*/\1/' metrics)
+compress -m $algo -b $level -c foo | cmp -s - foo.* || fail $LINENO "Level of $algo was adjusted"
+rm -rf cache compare foo foo.* metrics
+
+# Check that --best-of keeps the smallest result
+compressibleFile > compare
+compressibleFile > foo
+compress --best-of=lzw,gzip:9,gzip:1 foo || fail $LINENO "Compression with --best-of failed"
+test -e foo.gz || fail $LINENO "Smallest result was not kept"
+compress -d foo.gz || fail $LINENO "Decompression failed"
+cmp -s foo compare || fail $LINENO "Decompressed file contents are incorrect"
+rm -f foo
+compressibleFile | compress --best-of=gzip,lzw > foo.gz || fail $LINENO "Compression from stdin with --best-of failed"
+compress -d foo.gz || fail $LINENO "Decompression failed"
+cmp -s foo compare || fail $LINENO "Decompressed file contents are incorrect"
+compress --best-of=gzip:10 foo 2>/dev/null && fail $LINENO "Invalid level was accepted"
+rm -f foo.gz
+
+# Existing outputs of any candidate are checked before the race.
+echo existing > foo.Z
+compress --best-of=lzw,gzip foo < /dev/null 2>/dev/null && fail $LINENO "Existing output was not detected"
+test -e foo || fail $LINENO "Input file was unlinked"
+test ! -e foo.gz || fail $LINENO "Output file was unexpectedly created"
+rm -f foo.Z
+mkdir dir
+compressibleFile > dir/foo
+compressibleFile > dir/bar.Z
+compress --best-of=lzw,gzip -r dir || fail $LINENO "Recursive compression with --best-of failed"
+cmp -s dir/bar.Z compare || fail $LINENO "File with .Z extension was compressed"
+test -e dir/foo.gz || fail $LINENO "Output file was not created"
+rm -rf dir foo compare
+
+# Check that --formats creates a file for each format
+compressibleFile > compare
+compressibleFile > foo
+compress --formats=gz,Z,xz:9 foo || fail $LINENO "Compression with --formats failed"
+test ! -e foo || fail $LINENO "Input file was not unlinked"
+for extension in gz Z xz
+do
+    compress -cd foo.$extension > foo || fail $LINENO "Decompression of foo.$extension failed"
+    cmp -s foo compare || fail $LINENO "Decompressed file contents for foo.$extension are incorrect"
+done
+rm -f foo.gz foo.Z foo.xz
+incompressibleFile > foo
+compress --formats=gz,Z foo
+test $? = 2 || fail $LINENO "Exit status incorrect"
+test -e foo || fail $LINENO "Input file was unlinked"
+test ! -e foo.gz || fail $LINENO "Output file was unexpectedly created"
+compress -c --formats=gz foo > /dev/null 2>&1 && fail $LINENO "--formats was accepted with -c"
+rm -f foo compare
+
+# Check that --append only compresses new data when the input is kept
+seq 1 1000 > foo
+XDG_CACHE_HOME="$PWD/cache" compress -g --append -k foo || fail $LINENO "Appending failed"
+seq 1001 2000 >> foo
+XDG_CACHE_HOME="$PWD/cache" compress -g --append -k foo || fail $LINENO "Appending failed"
+compress -dc foo.gz | cmp -s - foo || fail $LINENO "Appended file contents are incorrect"
+seq 5 > foo
+XDG_CACHE_HOME="$PWD/cache" compress -g --append foo || fail $LINENO "Appending failed"
+test -e foo && fail $LINENO "Input file was not removed"
+compress -dc foo.gz > foo
+(seq 1 2000; seq 5) | cmp -s - foo || fail $LINENO "Appended file contents are incorrect"
+compress -m xz --append -o foo.gz foo 2>/dev/null && fail $LINENO "Appending to a file of another format succeeded"
+compress -dc foo.gz | cmp -s - foo || fail $LINENO "Existing file was modified"
+compress -O --append foo 2>/dev/null && fail $LINENO "Appending with lzw was accepted"
+rm -rf foo foo.gz cache
+if compress -m lz4 -c < /dev/null > /dev/null 2>&1; then
+    # The content size in the header must only count the appended data.
+    seq 1 1000 > foo
+    XDG_CACHE_HOME="$PWD/cache" compress -m lz4 --append -k foo || fail $LINENO "Appending failed"
+    seq 1001 2000 >> foo
+    XDG_CACHE_HOME="$PWD/cache" compress -m lz4 --append -k foo || fail $LINENO "Appending failed"
+    compress -dc foo.lz4 | cmp -s - foo || fail $LINENO "Appended lz4 file contents are incorrect"
+    rm -rf foo foo.lz4 cache
+
+    # The header must stay valid when the input grows while it is appended.
+    seq 1 1000000 > foo
+    (while :; do seq 1 100 >> foo; done) &
+    writer=$!
+    XDG_CACHE_HOME="$PWD/cache" compress -m lz4 -9 --append -k foo || fail $LINENO "Appending failed"
+    kill $writer
+    wait $writer 2>/dev/null
+    compress -dc foo.lz4 > bar || fail $LINENO "Decompression of a grown lz4 file failed"
+    head -c $(wc -c < bar) foo | cmp -s - bar || fail $LINENO "Grown lz4 file contents are incorrect"
+    rm -rf foo foo.lz4 bar cache
+fi
+
+# Check that --checkpoint compresses in segments and removes the checkpoint
+seq 1 20000 > foo
+for algo in gzip xz
+do
+    compress -m $algo -k --checkpoint=ckpt --checkpoint-interval=10K foo || fail $LINENO "Compression with $algo failed"
+    test -e ckpt && fail $LINENO "Checkpoint file was not removed"
+    compress -dc foo.* | cmp -s - foo || fail $LINENO "Decompressed file contents for $algo are incorrect"
+    rm -f foo.*
+done
+compress -O --checkpoint=ckpt foo 2>/dev/null && fail $LINENO "Checkpoint with lzw was accepted"
+
+# Check that --checkpoint resumes after the last completed segment
+if stat -c %i foo > /dev/null 2>&1; then
+    touch -t 200001020304 foo
+    head -c 10240 foo | compress -m gzip > part || fail $LINENO "Compression failed"
+    cat part part > foo.gz
+    printf 'dxcompress checkpoint 1\n%s %x %s %s 0 10240 %s\n' \
+        $(stat -c '%D' foo) $(stat -c '%i' foo) $(stat -c '%s %Y' foo) \
+        $(wc -c < part) > ckpt
+    compress -m gzip -k --checkpoint=ckpt --checkpoint-interval=10K foo || fail $LINENO "Resuming from a checkpoint failed"
+    test -e ckpt && fail $LINENO "Checkpoint file was not removed"
+    head -c $(wc -c < part) foo.gz | cmp -s - part || fail $LINENO "Completed segments were not kept"
+    compress -dc foo.gz | cmp -s - foo || fail $LINENO "Resumed file contents are incorrect"
+    rm -f part foo.gz
+fi
+
+# Check that the output is removed when no checkpoint was saved
+dd if=/dev/urandom of=bar bs=1024 count=256 2>/dev/null
+(trap '' XFSZ; ulimit -f 100; compress -g --checkpoint=ckpt --checkpoint-interval=1M bar) 2>/dev/null && fail $LINENO "Compression did not fail"
+test -e bar.gz && fail $LINENO "Output without a checkpoint was kept"
+compress -f -g --checkpoint=ckpt --checkpoint-interval=1M bar || fail $LINENO "Compression after a failure failed"
+rm -f bar bar.gz ckpt
+
+# Check that resuming keeps the output when only the rest does not compress
+if stat -c %i foo > /dev/null 2>&1; then
+    head -c 10240 foo > bar
+    dd if=/dev/urandom bs=1024 count=4 2>/dev/null >> bar
+    touch -t 200001020304 bar
+    head -c 10240 bar | compress -m gzip > part || fail $LINENO "Compression failed"
+    cp part bar.gz
+    printf 'dxcompress checkpoint 1\n%s %x %s %s 0 10240 %s\n' \
+        $(stat -c '%D' bar) $(stat -c '%i' bar) $(stat -c '%s %Y' bar) \
+        $(wc -c < part) > ckpt
+    compress -m gzip -k --checkpoint=ckpt --checkpoint-interval=10K bar || fail $LINENO "Resuming from a checkpoint failed"
+    compress -dc bar.gz | cmp -s - bar || fail $LINENO "Resumed output with an incompressible rest was removed"
+    rm -f part bar bar.gz
+fi
+rm -f foo foo.* ckpt
+
+# Check that --benchmark measures each level
+compressibleFile > foo
+lines=$(compress --benchmark=csv -m gzip -b 1-3 foo | wc -l) || fail $LINENO "Benchmark failed"
+test $lines -eq 4 || fail $LINENO "Benchmark printed $lines lines"
+compress -b 1-3 foo 2>/dev/null && fail $LINENO "Level range was accepted without --benchmark"
+rm -f foo
+
+# Check that flushed output can be decompressed
+(compressibleFile; sleep 1; compressibleFile) > compare
+for algo in lzw gzip xz
+do
+    (compressibleFile; sleep 1; compressibleFile) | compress -m $algo --flush-interval=10 -c > foo || fail $LINENO "Compression with $algo failed"
+    compress -dc foo | cmp -s - compare || fail $LINENO "Decompressed file contents for $algo are incorrect"
+    compressibleFile | compress -m $algo --flush-bytes=1 -c | compress -dc > foo || fail $LINENO "Flushing at the end failed for $algo"
+    compressibleFile | cmp -s - foo || fail $LINENO "Decompressed file contents for $algo are incorrect"
+done
+rm -f foo compare
+compress --flush-interval=0 -c < /dev/null > /dev/null 2>&1 && fail $LINENO "Invalid flush interval was accepted"
+
+# Check that --stats counts the bytes that were read and written
+compressibleFile > foo
+compress -g -k --stats foo 2> stats || fail $LINENO "Compression with --stats failed"
+size=$(($(wc -c < foo)))
+csize=$(($(wc -c < foo.gz)))
+grep -q "^foo: $size bytes in, $csize bytes out" stats || fail $LINENO "Statistics are incorrect"
+compress -dc --stats foo.gz foo.gz > /dev/null 2> stats || fail $LINENO "Decompression with --stats failed"
+test $(grep -c "bytes in" stats) -eq 3 || fail $LINENO "Total statistics are missing"
+grep -q "^total: $((2 * csize)) bytes in, $((2 * size)) bytes out" stats || fail $LINENO "Total statistics are incorrect"
+rm -f foo foo.gz stats
+
+# Check that --metrics-json writes a record for each file
+compressibleFile > foo
+dd if=/dev/urandom of=bar bs=1024 count=64 2>/dev/null
+compress -g -k --metrics-json=metrics foo bar
+test $? = 2 || fail $LINENO "Exit status incorrect"
+test $(wc -l < metrics) -eq 2 || fail $LINENO "Wrong number of metrics records"
+grep -q '^{"path": "foo", "mode": "compress", "algorithm": "deflate", "level": 6, "input_size": '"$(($(wc -c < foo)))"', "output_size": '"$(($(wc -c < foo.gz)))"',.*"result": "ok", "skipped": false}$' metrics || fail $LINENO "Metrics record is incorrect"
+grep -q '^{"path": "bar",.*"skipped": true}$' metrics || fail $LINENO "Skipped file was not recorded"
+compress -t --metrics-json=metrics foo.gz missing.Z 2>/dev/null
+grep -q '"path": "missing.Z", "mode": "test",.*"result": "open_failure"' metrics || fail $LINENO "Failure was not recorded"
+rm -f foo.gz metrics
+compress -g -k -T 8 --metrics-json=metrics foo || fail $LINENO "Compression failed"
+grep -q '"threads": 1,' metrics || fail $LINENO "Threads of gzip were not recorded as 1"
+rm -f foo foo.gz bar metrics
+
+# Check that --progress prints the final progress of each file
+compressibleFile > foo
+compress -g -k --progress foo 2> progress || fail $LINENO "Compression with --progress failed"
+grep -q '^foo: .* (100\.0%), .*, ratio 0\.[0-9]*$' progress || fail $LINENO "Progress is incorrect"
+compress -dc --progress < foo.gz 2> progress | cmp -s - foo || fail $LINENO "Decompression with --progress failed"
+grep -q '^stdin: .* (100\.0%), .*, ratio 0\.[0-9]*$' progress || fail $LINENO "Decompression progress is incorrect"
+compress -l --progress foo.gz > /dev/null 2> progress || fail $LINENO "Listing with --progress failed"
+test -s progress && fail $LINENO "Listing printed progress"
+rm -f foo foo.gz progress
+
+# Check that --trace writes spans for files and I/O
+compressibleFile > foo
+compressibleFile > bar
+compress -g --trace=trace foo bar || fail $LINENO "Compression with --trace failed"
+grep -q '"name": "foo", "cat": "file"' trace || fail $LINENO "File span is missing"
+grep -q '"name": "read", "cat": "io"' trace || fail $LINENO "Read span is missing"
+grep -q '"name": "codec", "cat": "codec"' trace || fail $LINENO "Codec span is missing"
+tail -n 1 trace | grep -q '^\], "displayTimeUnit": "ms"}$' || fail $LINENO "Trace is incomplete"
+compress -l --trace=trace foo.gz missing > /dev/null 2>&1
+grep -q '"name": "foo.gz", "cat": "file"' trace || fail $LINENO "File span for -l is missing"
+grep -q '"name": "missing.Z", "cat": "file"' trace || fail $LINENO "File span for a failed file is missing"
+rm -f foo.gz bar.gz trace
+
+# Check that --recompress converts between formats
+compressibleFile > compare
+compressibleFile | compress -g > foo.gz
+compress --recompress -m xz foo.gz || fail $LINENO "Recompression failed"
+test ! -e foo.gz || fail $LINENO "Input file was not unlinked"
+test -e foo.xz || fail $LINENO "Output file was not created"
+compress --recompress -O foo.xz || fail $LINENO "Recompression failed"
+compress -d foo.Z || fail $LINENO "Decompression failed"
+cmp -s foo compare || fail $LINENO "Decompressed file contents are incorrect"
+compress --recompress -g -c foo 2>/dev/null && fail $LINENO "Uncompressed input was accepted"
+rm -f foo foo.gz foo.xz foo.Z
+
+# The original name and modification time are carried over. The input is large
+# enough that the decoder is still running when the encoder starts.
+awk 'BEGIN { for (i = 0; i < 1000000; i++) print i }' > foo
+touch -t 200001020304 foo
+compress -g foo || fail $LINENO "Compression failed"
+mv foo.gz bar.gz
+compress --recompress -g -c bar.gz > baz.gz || fail $LINENO "Recompression failed"
+compress -dN baz.gz || fail $LINENO "Decompression with -N failed"
+test -e foo || fail $LINENO "Original name was not carried over"
+test ! -e baz || fail $LINENO "Wrong output file was created"
+touch -t 200001020304 compare
+test foo -nt compare && fail $LINENO "Original modification time was not carried over"
+test compare -nt foo && fail $LINENO "Original modification time was not carried over"
+rm -f foo bar.gz baz.gz
+
+# Without a name in the input the name without the extension is stored.
+compressibleFile > compare
+compressibleFile | compress > foo.Z
+compress --recompress -g foo.Z || fail $LINENO "Recompression failed"
+mkdir dir
+mv foo.gz dir/bar.gz
+(cd dir && compress -dN bar.gz) || fail $LINENO "Decompression with -N failed"
+cmp -s dir/foo compare || fail $LINENO "Name without the extension was not stored"
+rm -rf dir compare
+
+# Check that adjusting the level to reach --target-speed works
+awk 'BEGIN { for (i = 0; i < 1000000; i++) print i }' > compare
+for options in "-g -1" "-g -9" "-m xz -0" "-m xz -9 -T2"
+do
+    compress $options -c compare > bar || fail $LINENO "Compression with $options failed"
+    # A speed that is always reached raises the level and a speed that is never
+    # reached lowers it.
+    case $options in
+    *-1|*-0) target=1K ;;
+    *) target=1T ;;
+    esac
+    compress $options --target-speed=$target -c compare > foo || fail $LINENO "Compression with $options --target-speed=$target failed"
+    compress -dc foo | cmp -s - compare || fail $LINENO "Decompressed file contents for $options are incorrect"
+    if [ $target = 1K ]; then
+        test $(wc -c < foo) -lt $(wc -c < bar) || fail $LINENO "Level for $options was not raised"
+    else
+        test $(wc -c < foo) -gt $(wc -c < bar) || fail $LINENO "Level for $options was not lowered"
+    fi
+done
+rm -f foo bar compare
+
+# Check that --probe-size gives up on incompressible files
+dd if=/dev/urandom of=foo bs=1024 count=256 2>/dev/null
+cp foo compare
+compress -g --probe-size=64K foo
+test $? = 2 || fail $LINENO "Exit status incorrect"
+test -e foo || fail $LINENO "Input file was unlinked"
+test ! -e foo.gz || fail $LINENO "Output file was unexpectedly created"
+cmp -s foo compare || fail $LINENO "Input file was modified"
+compressibleFile > foo
+compressibleFile > compare
+compress -g --probe-size=64K foo || fail $LINENO "Compression with --probe-size failed"
+compress -d foo.gz || fail $LINENO "Decompression failed"
+cmp -s foo compare || fail $LINENO "Decompressed file contents are incorrect"
+rm -f foo foo.gz compare
+
+# The savings are only checked once at the probe size.
+yes | head -c 131072 > foo
+dd if=/dev/urandom bs=1024 count=8192 2>/dev/null >> foo
+cp foo compare
+compress -g --probe-size=64K foo || fail $LINENO "Compression was aborted after the probe size"
+compress -d foo.gz || fail $LINENO "Decompression failed"
+cmp -s foo compare || fail $LINENO "Decompressed file contents are incorrect"
+rm -f foo foo.gz compare
+
+# Check that incompressible files are skipped in directories
+mkdir dir1
+dd if=/dev/urandom of=dir1/foo bs=1024 count=64 2>/dev/null
+compressibleFile | compress -g > dir1/bar
+compressibleFile > dir1/baz
+compress -r dir1 || fail $LINENO "Recursive compression failed"
+test -e dir1/foo || fail $LINENO "Random file was unlinked"
+test ! -e dir1/foo.Z || fail $LINENO "Random file was compressed"
+test -e dir1/bar || fail $LINENO "Compressed file was unlinked"
+test ! -e dir1/bar.Z || fail $LINENO "Compressed file was compressed again"
+test -e dir1/baz.Z || fail $LINENO "Compressible file was not compressed"
+compress -rf dir1 || fail $LINENO "Recursive compression with -f failed"
+test -e dir1/foo.Z || fail $LINENO "Random file was not compressed with -f"
+rm -rf dir1
+
 # Check the -z option
 compressibleFile > foo
 compress -d -z foo || fail $LINENO "Compression failed"
@@ -504,6 +943,36 @@ test -e foo || fail $LINENO "Output file was not created"
 test ! -e foo.Z || fail $LINENO "Input file was not unlinked"
 rm -f foo foo.Z
 
+# Check that multiple files can be (de)compressed by a single invocation
+compressibleFile > compare
+incompressibleFile > compare2
+for algo in lzw gzip xz
+do
+    compressibleFile > foo
+    incompressibleFile > bar
+    compressibleFile > baz
+    compress -f -m $algo foo bar baz || fail $LINENO "Compression with $algo failed"
+    compress -d foo.* bar.* baz.* || fail $LINENO "Decompression for $algo failed"
+    cmp -s foo compare || fail $LINENO "Decompressed file contents for $algo are incorrect"
+    cmp -s bar compare2 || fail $LINENO "Decompressed file contents for $algo are incorrect"
+    cmp -s baz compare || fail $LINENO "Decompressed file contents for $algo are incorrect"
+    rm -f foo bar baz
+done
+rm -f compare compare2
+
+# Check that a file that failed to compress does not affect the next file
+dd if=/dev/urandom of=foo bs=1024 count=2048 2>/dev/null
+seq 1 20000 > bar
+cp bar compare
+for algo in gzip xz
+do
+    (trap '' XFSZ; ulimit -f 400; compress -f -m $algo -T1 foo bar) 2>/dev/null && fail $LINENO "Compression with $algo did not fail"
+    compress -dc bar.* | cmp -s - compare || fail $LINENO "Second file for $algo is incorrect"
+    rm -f foo.* bar.*
+    cp compare bar
+done
+rm -f foo bar compare
+
 # Check that compress refuses to create file containing a newline in its name
 compressibleFile > foo
 msg="$(compress -o 'foo
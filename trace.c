@@ -0,0 +1,256 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* trace.c
+ * Timeline of the work of each thread in the Chrome trace event format.
+ */
+
+#include <config.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "algorithm.h"
+
+// Buffers start small because many threads only live for one block.
+#define MIN_BUFFER_EVENTS 16
+#define MAX_BUFFER_EVENTS 4096
+
+struct event {
+    const char* name;
+    const char* category;
+    uint64_t start;
+    uint64_t duration;
+    // Number of bytes, or -1 if the event has no size.
+    int64_t bytes;
+    bool ownedName;
+};
+
+// Each thread records its events into a buffer of its own, so that locking is
+// only needed when a full buffer is written to the trace file.
+struct tracer {
+    int thread;
+    size_t count;
+    size_t capacity;
+    struct event* events;
+};
+
+bool tracing = false;
+// The mutex protects the trace file and the thread ids.
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE* traceFile;
+static bool firstEvent = true;
+static uint64_t traceStart;
+static int numThreads;
+// Ids of threads that have exited. They are given to new threads so that the
+// threads that are created for each batch of blocks share rows in the trace.
+static int* freeThreads;
+static size_t numFreeThreads;
+static pthread_key_t tracerKey;
+
+static _Thread_local struct tracer* currentTracer;
+// End of the last I/O of this thread, or 0 if the thread is not in the middle
+// of processing a file.
+static _Thread_local uint64_t lastIo;
+
+static uint64_t getNanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * UINT64_C(1000000000) + now.tv_nsec;
+}
+
+// Must be called with the mutex held.
+static void writeSeparator(void) {
+    if (!firstEvent) fputs(",\n", traceFile);
+    firstEvent = false;
+}
+
+// Writes the buffered events of the thread to the trace file.
+static void flushEvents(struct tracer* tracer) {
+    int pid = getpid();
+    pthread_mutex_lock(&traceMutex);
+    for (size_t i = 0; i < tracer->count; i++) {
+        const struct event* event = &tracer->events[i];
+        writeSeparator();
+        fputs("{\"name\": ", traceFile);
+        writeJsonString(traceFile, event->name);
+        fprintf(traceFile, ", \"cat\": \"%s\", \"ph\": \"X\", "
+                "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d",
+                event->category, (event->start - traceStart) / 1000.0,
+                event->duration / 1000.0, pid, tracer->thread);
+        if (event->bytes >= 0) {
+            fprintf(traceFile, ", \"args\": {\"bytes\": %jd}",
+                    (intmax_t) event->bytes);
+        }
+        putc('}', traceFile);
+        if (event->ownedName) free((void*) event->name);
+    }
+    pthread_mutex_unlock(&traceMutex);
+    tracer->count = 0;
+}
+
+static void finishThread(void* arg) {
+    struct tracer* tracer = arg;
+    flushEvents(tracer);
+    pthread_mutex_lock(&traceMutex);
+    int* threads = realloc(freeThreads,
+            (numFreeThreads + 1) * sizeof(int));
+    // The id is not reused when out of memory.
+    if (threads) {
+        freeThreads = threads;
+        freeThreads[numFreeThreads++] = tracer->thread;
+    }
+    pthread_mutex_unlock(&traceMutex);
+    free(tracer->events);
+    free(tracer);
+}
+
+static struct tracer* createTracer(void) {
+    struct tracer* tracer = malloc(sizeof(struct tracer));
+    if (!tracer) return NULL;
+    tracer->events = malloc(MIN_BUFFER_EVENTS * sizeof(struct event));
+    if (!tracer->events) {
+        free(tracer);
+        return NULL;
+    }
+    tracer->count = 0;
+    tracer->capacity = MIN_BUFFER_EVENTS;
+
+    pthread_mutex_lock(&traceMutex);
+    if (numFreeThreads > 0) {
+        tracer->thread = freeThreads[--numFreeThreads];
+    } else {
+        tracer->thread = ++numThreads;
+        writeSeparator();
+        fprintf(traceFile, "{\"name\": \"thread_name\", \"ph\": \"M\", "
+                "\"pid\": %d, \"tid\": %d, \"args\": {\"name\": ",
+                getpid(), tracer->thread);
+        if (tracer->thread == 1) {
+            fputs("\"main\"}}", traceFile);
+        } else {
+            fprintf(traceFile, "\"thread %d\"}}", tracer->thread);
+        }
+    }
+    pthread_mutex_unlock(&traceMutex);
+
+    // The main thread is flushed by writeTrace and other threads when they
+    // exit.
+    if (tracer->thread != 1) pthread_setspecific(tracerKey, tracer);
+    currentTracer = tracer;
+    return tracer;
+}
+
+static struct event* addEvent(void) {
+    struct tracer* tracer = currentTracer;
+    if (!tracer) {
+        tracer = createTracer();
+        // Events are dropped when out of memory.
+        if (!tracer) return NULL;
+    }
+
+    if (tracer->count == tracer->capacity) {
+        struct event* events = NULL;
+        if (tracer->capacity < MAX_BUFFER_EVENTS) {
+            events = realloc(tracer->events,
+                    2 * tracer->capacity * sizeof(struct event));
+        }
+        if (events) {
+            tracer->events = events;
+            tracer->capacity *= 2;
+        } else {
+            flushEvents(tracer);
+        }
+    }
+    return &tracer->events[tracer->count++];
+}
+
+static void addSpan(const char* name, const char* category, uint64_t start,
+        uint64_t end, int64_t bytes, bool ownedName) {
+    struct event* event = addEvent();
+    if (!event) {
+        if (ownedName) free((void*) name);
+        return;
+    }
+    event->name = name;
+    event->category = category;
+    event->start = start;
+    event->duration = end - start;
+    event->bytes = bytes;
+    event->ownedName = ownedName;
+}
+
+uint64_t beginTraceFile(void) {
+    if (!tracing) return 0;
+    lastIo = 0;
+    return getNanoseconds();
+}
+
+void endTraceFile(const char* path, uint64_t start) {
+    if (!tracing) return;
+    char* name = strdup(path);
+    if (name) addSpan(name, "file", start, getNanoseconds(), -1, true);
+    lastIo = 0;
+}
+
+bool startTrace(const char* path) {
+    if (pthread_key_create(&tracerKey, finishThread) != 0) return false;
+    traceFile = fopen(path, "w");
+    if (!traceFile) return false;
+    traceStart = getNanoseconds();
+    fputs("{\"traceEvents\": [\n", traceFile);
+    // The main thread is always the first one.
+    if (!createTracer()) {
+        fclose(traceFile);
+        return false;
+    }
+    tracing = true;
+    return true;
+}
+
+void traceBlock(uint64_t start) {
+    if (!tracing) return;
+    addSpan("block", "codec", start, getNanoseconds(), -1, false);
+}
+
+void traceIo(const char* name, uint64_t start, ssize_t result) {
+    uint64_t end = getNanoseconds();
+    // Whatever the thread did between two reads or writes was spent in the
+    // codec.
+    if (lastIo) addSpan("codec", "codec", lastIo, start, -1, false);
+    addSpan(name, "io", start, end, result > 0 ? result : 0, false);
+    lastIo = end;
+}
+
+uint64_t traceTime(void) {
+    return tracing ? getNanoseconds() : 0;
+}
+
+bool writeTrace(void) {
+    // This is called at exit, when all other threads have finished.
+    tracing = false;
+    if (currentTracer) {
+        flushEvents(currentTracer);
+        free(currentTracer->events);
+        free(currentTracer);
+        currentTracer = NULL;
+    }
+    fputs("\n], \"displayTimeUnit\": \"ms\"}\n", traceFile);
+    free(freeThreads);
+    freeThreads = NULL;
+    numFreeThreads = 0;
+    bool error = ferror(traceFile);
+    return fclose(traceFile) == 0 && !error;
+}
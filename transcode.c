@@ -0,0 +1,134 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* transcode.c
+ * Conversion of compressed data into another format.
+ */
+
+#include <config.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "algorithm.h"
+
+// A larger pipe lets the decoder run further ahead of the encoder.
+#define PIPE_SIZE (1024 * 1024)
+
+struct decoder {
+    const struct algorithm* algorithm;
+    int input;
+    int output;
+    const unsigned char* buffer;
+    size_t bufferSize;
+    struct fileinfo info;
+    int result;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    // Whether the name and modification time in info are final.
+    bool headerReported;
+};
+
+// The decoder that is run by the current thread, if any.
+static _Thread_local struct decoder* currentDecoder;
+
+void reportHeader(struct fileinfo* info) {
+    struct decoder* decoder = currentDecoder;
+    if (!decoder || info != &decoder->info) return;
+    pthread_mutex_lock(&decoder->mutex);
+    decoder->headerReported = true;
+    pthread_cond_signal(&decoder->condition);
+    pthread_mutex_unlock(&decoder->mutex);
+}
+
+static void* runDecoder(void* arg) {
+    struct decoder* decoder = arg;
+    currentDecoder = decoder;
+
+    // When the encoder stops reading early the write fails with EPIPE. The
+    // signal stays pending on this thread and is discarded when it exits.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    decoder->result = decoder->algorithm->decompress(decoder->input,
+            decoder->output, &decoder->info, decoder->buffer,
+            decoder->bufferSize);
+    // The header was not reported if the decoder failed before parsing it.
+    reportHeader(&decoder->info);
+    close(decoder->output);
+    freeCaches();
+    return NULL;
+}
+
+int transcode(int input, int output, const struct algorithm* from,
+        const unsigned char* buffer, size_t bufferSize,
+        const struct algorithm* to, int level, struct fileinfo* info) {
+    int fds[2];
+    if (pipe(fds) < 0) return RESULT_UNKNOWN_ERROR;
+#ifdef F_SETPIPE_SZ
+    fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+#endif
+
+    struct decoder decoder = {0};
+    decoder.algorithm = from;
+    decoder.input = input;
+    decoder.output = fds[1];
+    decoder.buffer = buffer;
+    decoder.bufferSize = bufferSize;
+    pthread_mutex_init(&decoder.mutex, NULL);
+    pthread_cond_init(&decoder.condition, NULL);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, runDecoder, &decoder) != 0) {
+        pthread_cond_destroy(&decoder.condition);
+        pthread_mutex_destroy(&decoder.mutex);
+        close(fds[0]);
+        close(fds[1]);
+        return RESULT_UNKNOWN_ERROR;
+    }
+
+    // The original name and modification time are stored in the new header,
+    // so the encoder can only start once the decoder has parsed the header.
+    pthread_mutex_lock(&decoder.mutex);
+    while (!decoder.headerReported) {
+        pthread_cond_wait(&decoder.condition, &decoder.mutex);
+    }
+    pthread_mutex_unlock(&decoder.mutex);
+    // No metadata is stored when the caller left the time at zero.
+    const char* name = info->name;
+    bool saveMetadata = info->modificationTime.tv_sec != 0 ||
+            info->modificationTime.tv_nsec != 0;
+    if (saveMetadata && decoder.info.name) info->name = decoder.info.name;
+    if (saveMetadata && (decoder.info.modificationTime.tv_sec != 0 ||
+            decoder.info.modificationTime.tv_nsec != 0)) {
+        info->modificationTime = decoder.info.modificationTime;
+    }
+
+    int result = to->compress(fds[0], output, level, info);
+    close(fds[0]);
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&decoder.condition);
+    pthread_mutex_destroy(&decoder.mutex);
+    info->name = name;
+    free((void*) decoder.info.name);
+    // The decoder runs in a thread of its own.
+    info->threads = (info->threads > 0 ? info->threads : 1) +
+            (decoder.info.threads > 0 ? decoder.info.threads : 1);
+
+    if (result != RESULT_OK) return result;
+    return decoder.result;
+}
@@ -1,4 +1,4 @@
-/* Copyright (c) 2020, 2022 Dennis Wölfing
+/* Copyright (c) 2020, 2022, 2026 Dennis Wölfing
  *
  * Permission to use, copy, modify, and/or distribute this software for any
  * purpose with or without fee is hereby granted, provided that the above
@@ -18,6 +18,7 @@
  */
 
 #include <config.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include "algorithm.h"
@@ -29,6 +30,7 @@
 static int xzCompress(int input, int output, int level, struct fileinfo* info);
 static int xzDecompress(int input, int output, struct fileinfo* info,
         const unsigned char* buffer, size_t bufferSize);
+static void xzFreeCache(void);
 static bool xzProbe(const unsigned char* buffer, size_t bufferSize);
 
 const struct algorithm algoXz = {
@@ -39,7 +41,8 @@ const struct algorithm algoXz = {
     .maxLevel = 9,
     .compress = xzCompress,
     .decompress = xzDecompress,
-    .probe = xzProbe
+    .probe = xzProbe,
+    .freeCache = xzFreeCache
 };
 
 #define BUFFER_SIZE (4096 * 8)
@@ -50,7 +53,27 @@ static bool xzProbe(const unsigned char* buffer, size_t bufferSize) {
 }
 
 #if WITH_LIBLZMA
-static lzma_ret createEncoder(lzma_stream* stream, int level) {
+// The streams are kept alive between files. Reinitializing an existing stream
+// allows liblzma to reuse the already allocated dictionary, match finder and
+// worker threads.
+static _Thread_local lzma_stream encoderStream = LZMA_STREAM_INIT;
+static _Thread_local lzma_stream decoderStream = LZMA_STREAM_INIT;
+
+static void* lzmaAlloc(void* opaque, size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) return NULL;
+    return allocateMemory(opaque, nmemb * size);
+}
+
+static void lzmaFree(void* opaque, void* ptr) {
+    (void) opaque;
+    freeMemory(ptr);
+}
+
+static _Thread_local lzma_allocator allocator = { lzmaAlloc, lzmaFree, NULL };
+
+// Creates the encoder and stores the number of threads used in *threads.
+static lzma_ret createEncoder(lzma_stream* stream, int level, int* threads) {
+    *threads = 1;
 #if HAVE_LZMA_STREAM_ENCODER_MT
     lzma_mt mt = {0};
     mt.preset = level;
@@ -62,22 +85,29 @@ static lzma_ret createEncoder(lzma_stream* stream, int level) {
         mt.threads = lzma_cputhreads();
     }
 
+    // Reduce the number of threads rather than failing when the memory limit
+    // given by --memory-limit would be exceeded.
+    uint64_t memoryAvailable = getMemoryBudget();
     if (maxThreads == -1) {
         // When the -T option was not given we still want to use multiple
         // threads but we should limit the number of threads to avoid high
         // memory usage. We try to limit our memory usage to one third of the
         // available memory.
-        uint64_t memoryAvailable = lzma_physmem();
-        uint64_t memoryUsage = lzma_stream_encoder_mt_memusage(&mt);
-
-        while (memoryUsage > memoryAvailable / 3 && mt.threads > 1) {
-            mt.threads--;
-            memoryUsage = lzma_stream_encoder_mt_memusage(&mt);
+        if (lzma_physmem() / 3 < memoryAvailable) {
+            memoryAvailable = lzma_physmem() / 3;
         }
     }
 
-    if (mt.threads > 1) {
+    uint64_t memoryUsage = lzma_stream_encoder_mt_memusage(&mt);
+    while (memoryUsage > memoryAvailable && mt.threads > 1) {
+        mt.threads--;
+        memoryUsage = lzma_stream_encoder_mt_memusage(&mt);
+    }
+
+    // The multi-threaded encoder does not support LZMA_SYNC_FLUSH.
+    if (mt.threads > 1 && !flushBytes && !flushInterval) {
         if (lzma_stream_encoder_mt(stream, &mt) == LZMA_OK) {
+            *threads = mt.threads;
             return LZMA_OK;
         }
     }
@@ -85,44 +115,105 @@ static lzma_ret createEncoder(lzma_stream* stream, int level) {
 
     return lzma_easy_encoder(stream, level, LZMA_CHECK_CRC64);
 }
+
+// Switches to a new preset for the following blocks. The current block must
+// have been finished with LZMA_FULL_BARRIER.
+static lzma_ret updatePreset(lzma_stream* stream, int level) {
+    lzma_options_lzma options;
+    if (lzma_lzma_preset(&options, level)) return LZMA_OPTIONS_ERROR;
+    lzma_filter filters[] = {
+        { LZMA_FILTER_LZMA2, &options },
+        { LZMA_VLI_UNKNOWN, NULL }
+    };
+    return lzma_filters_update(stream, filters);
+}
+#endif
+
+static void xzFreeCache(void) {
+#if WITH_LIBLZMA
+    lzma_end(&encoderStream);
+    lzma_end(&decoderStream);
 #endif
+}
 
 static int xzCompress(int input, int output, int level, struct fileinfo* info) {
 #if WITH_LIBLZMA
-    lzma_stream stream = LZMA_STREAM_INIT;
-    lzma_ret status = createEncoder(&stream, level);
+    lzma_stream* stream = &encoderStream;
+    allocator.opaque = getThreadAccount();
+    stream->allocator = &allocator;
+    lzma_ret status = createEncoder(stream, level, &info->threads);
     if (status == LZMA_MEM_ERROR) return RESULT_OUT_OF_MEMORY;
     if (status != LZMA_OK) return RESULT_UNKNOWN_ERROR;
 
     unsigned char inputBuffer[BUFFER_SIZE];
     unsigned char outputBuffer[BUFFER_SIZE];
-    stream.next_out = outputBuffer;
-    stream.avail_out = sizeof(outputBuffer);
+    // A reused stream might still point to the input of a failed earlier file.
+    stream->next_in = NULL;
+    stream->avail_in = 0;
+    stream->next_out = outputBuffer;
+    stream->avail_out = sizeof(outputBuffer);
+
+    struct levelcontrol control;
+    initLevelControl(&control, level, algoXz.minLevel, algoXz.maxLevel);
+    lzma_action action = LZMA_RUN;
+    struct flushcontrol flush = {0};
 
     while (true) {
-        if (stream.avail_out == 0) {
+        if (stream->avail_out == 0) {
             if (writeAll(output, outputBuffer, sizeof(outputBuffer)) < 0) {
-                lzma_end(&stream);
                 return RESULT_WRITE_ERROR;
             }
-            stream.next_out = outputBuffer;
-            stream.avail_out = sizeof(outputBuffer);
+            stream->next_out = outputBuffer;
+            stream->avail_out = sizeof(outputBuffer);
         }
 
-        if (stream.avail_in == 0) {
-            ssize_t bytesRead = read(input, inputBuffer, sizeof(inputBuffer));
-            if (bytesRead < 0) {
-                lzma_end(&stream);
-                return RESULT_READ_ERROR;
+        if (stream->avail_in == 0 && action == LZMA_RUN) {
+            info->uncompressedSize = stream->total_in;
+            info->compressedSize = stream->total_out;
+            if (!reportProgress(info)) return RESULT_ABORTED;
+
+            if (adjustLevel(&control, stream->total_in) != level) {
+                // The preset can only be changed at a block boundary.
+                action = LZMA_FULL_BARRIER;
+                continue;
             }
-            stream.next_in = inputBuffer;
-            stream.avail_in = bytesRead;
+            if (shouldFlush(input, &flush)) {
+                action = LZMA_SYNC_FLUSH;
+                continue;
+            }
+
+            ssize_t bytesRead = readInput(input, inputBuffer,
+                    sizeof(inputBuffer));
+            if (bytesRead < 0) return RESULT_READ_ERROR;
+            PROBE2(block, "xz", bytesRead);
+            stream->next_in = inputBuffer;
+            stream->avail_in = bytesRead;
+            addFlushInput(&flush, bytesRead);
             if (bytesRead == 0) break;
         }
 
-        status = lzma_code(&stream, LZMA_RUN);
+        status = lzma_code(stream, action);
+        if (status == LZMA_STREAM_END && action == LZMA_FULL_BARRIER) {
+            // Keep the old level if the new one cannot be used.
+            if (updatePreset(stream, control.level) == LZMA_OK) {
+                level = control.level;
+            } else {
+                control.level = level;
+            }
+            action = LZMA_RUN;
+            continue;
+        }
+        if (status == LZMA_STREAM_END && action == LZMA_SYNC_FLUSH) {
+            if (writeAll(output, outputBuffer,
+                    sizeof(outputBuffer) - stream->avail_out) < 0) {
+                return RESULT_WRITE_ERROR;
+            }
+            stream->next_out = outputBuffer;
+            stream->avail_out = sizeof(outputBuffer);
+            action = LZMA_RUN;
+            continue;
+        }
         if (status != LZMA_OK) {
-            lzma_end(&stream);
             // LZMA_DATA_ERROR means the data exceeds the maximum possible size.
             return status == LZMA_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
                     status == LZMA_DATA_ERROR ? RESULT_FORMAT_ERROR :
@@ -131,25 +222,22 @@ static int xzCompress(int input, int output, int level, struct fileinfo* info) {
     }
 
     do {
-        status = lzma_code(&stream, LZMA_FINISH);
+        status = lzma_code(stream, LZMA_FINISH);
         if (status != LZMA_OK && status != LZMA_STREAM_END) {
-            lzma_end(&stream);
             return status == LZMA_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
                     status == LZMA_DATA_ERROR ? RESULT_FORMAT_ERROR :
                     RESULT_UNKNOWN_ERROR;
         }
         if (writeAll(output, outputBuffer,
-                sizeof(outputBuffer) - stream.avail_out) < 0) {
-            lzma_end(&stream);
+                sizeof(outputBuffer) - stream->avail_out) < 0) {
             return RESULT_WRITE_ERROR;
         }
-        stream.next_out = outputBuffer;
-        stream.avail_out = sizeof(outputBuffer);
+        stream->next_out = outputBuffer;
+        stream->avail_out = sizeof(outputBuffer);
     } while (status != LZMA_STREAM_END);
 
-    info->uncompressedSize = stream.total_in;
-    info->compressedSize = stream.total_out;
-    lzma_end(&stream);
+    info->uncompressedSize = stream->total_in;
+    info->compressedSize = stream->total_out;
     return RESULT_OK;
 #else
     (void) input; (void) output; (void) level; (void) info;
@@ -160,13 +248,16 @@ static int xzCompress(int input, int output, int level, struct fileinfo* info) {
 static int xzDecompress(int input, int output, struct fileinfo* info,
         const unsigned char* buffer, size_t bufferSize) {
 #if WITH_LIBLZMA
+    reportHeader(info);
     if (output == -2) {
         output = openOutputFile(NULL, info->oinfo);
         if (output < 0) return RESULT_OPEN_FAILURE;
     }
 
-    lzma_stream stream = LZMA_STREAM_INIT;
-    lzma_ret status = lzma_stream_decoder(&stream, UINT64_MAX,
+    lzma_stream* stream = &decoderStream;
+    allocator.opaque = getThreadAccount();
+    stream->allocator = &allocator;
+    lzma_ret status = lzma_stream_decoder(stream, UINT64_MAX,
             LZMA_CONCATENATED);
     if (status == LZMA_MEM_ERROR) return RESULT_OUT_OF_MEMORY;
     if (status != LZMA_OK) return RESULT_UNKNOWN_ERROR;
@@ -175,35 +266,36 @@ static int xzDecompress(int input, int output, struct fileinfo* info,
     unsigned char outputBuffer[BUFFER_SIZE];
     memcpy(inputBuffer, buffer, bufferSize);
 
-    stream.next_in = inputBuffer;
-    stream.avail_in = bufferSize;
-    stream.next_out = outputBuffer;
-    stream.avail_out = sizeof(outputBuffer);
+    stream->next_in = inputBuffer;
+    stream->avail_in = bufferSize;
+    stream->next_out = outputBuffer;
+    stream->avail_out = sizeof(outputBuffer);
 
     while (true) {
-        if (stream.avail_out == 0) {
+        if (stream->avail_out == 0) {
             if (writeAll(output, outputBuffer, sizeof(outputBuffer)) < 0) {
-                lzma_end(&stream);
                 return RESULT_WRITE_ERROR;
             }
-            stream.next_out = outputBuffer;
-            stream.avail_out = sizeof(outputBuffer);
+            stream->next_out = outputBuffer;
+            stream->avail_out = sizeof(outputBuffer);
         }
 
-        if (stream.avail_in == 0) {
-            ssize_t bytesRead = read(input, inputBuffer, sizeof(inputBuffer));
-            if (bytesRead < 0) {
-                lzma_end(&stream);
-                return RESULT_READ_ERROR;
-            }
-            stream.next_in = inputBuffer;
-            stream.avail_in = bytesRead;
+        if (stream->avail_in == 0) {
+            info->compressedSize = stream->total_in;
+            info->uncompressedSize = stream->total_out;
+            if (!reportProgress(info)) return RESULT_ABORTED;
+
+            ssize_t bytesRead = readInput(input, inputBuffer,
+                    sizeof(inputBuffer));
+            if (bytesRead < 0) return RESULT_READ_ERROR;
+            PROBE2(block, "xz", bytesRead);
+            stream->next_in = inputBuffer;
+            stream->avail_in = bytesRead;
             if (bytesRead == 0) break;
         }
 
-        status = lzma_code(&stream, LZMA_RUN);
+        status = lzma_code(stream, LZMA_RUN);
         if (status != LZMA_OK) {
-            lzma_end(&stream);
             return status == LZMA_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
                     status == LZMA_FORMAT_ERROR ? RESULT_FORMAT_ERROR :
                     status == LZMA_DATA_ERROR ? RESULT_FORMAT_ERROR :
@@ -212,27 +304,24 @@ static int xzDecompress(int input, int output, struct fileinfo* info,
     }
 
     do {
-        status = lzma_code(&stream, LZMA_FINISH);
+        status = lzma_code(stream, LZMA_FINISH);
         if (status != LZMA_OK && status != LZMA_STREAM_END) {
-            lzma_end(&stream);
             return status == LZMA_MEM_ERROR ? RESULT_OUT_OF_MEMORY :
                     status == LZMA_FORMAT_ERROR ? RESULT_FORMAT_ERROR :
                     status == LZMA_DATA_ERROR ? RESULT_FORMAT_ERROR :
                     RESULT_UNKNOWN_ERROR;
         }
         if (writeAll(output, outputBuffer,
-                sizeof(outputBuffer) - stream.avail_out) < 0) {
-            lzma_end(&stream);
+                sizeof(outputBuffer) - stream->avail_out) < 0) {
             return RESULT_WRITE_ERROR;
         }
-        stream.next_out = outputBuffer;
-        stream.avail_out = sizeof(outputBuffer);
+        stream->next_out = outputBuffer;
+        stream->avail_out = sizeof(outputBuffer);
     } while (status != LZMA_STREAM_END);
 
-    info->compressedSize = stream.total_in;
-    info->uncompressedSize = stream.total_out;
+    info->compressedSize = stream->total_in;
+    info->uncompressedSize = stream->total_out;
     info->crc = -1;
-    lzma_end(&stream);
 
     return RESULT_OK;
 #else
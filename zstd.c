@@ -0,0 +1,288 @@
+/* Copyright (c) 2026 Dennis Wölfing
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* zstd.c
+ * Zstandard compression.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <unistd.h>
+#include "algorithm.h"
+
+#if WITH_LIBZSTD
+// Needed for custom allocators and memory estimates.
+#  define ZSTD_STATIC_LINKING_ONLY
+#  include <zstd.h>
+#  include <zstd_errors.h>
+#endif
+
+static int zstdCompress(int input, int output, int level,
+        struct fileinfo* info);
+static int zstdDecompress(int input, int output, struct fileinfo* info,
+        const unsigned char* buffer, size_t bufferSize);
+static void zstdFreeCache(void);
+static bool zstdProbe(const unsigned char* buffer, size_t bufferSize);
+
+const struct algorithm algoZstd = {
+    .names = "zstd",
+    .extensions = "zst,tzst:tar",
+    .minLevel = 1,
+    .defaultLevel = 3,
+    .maxLevel = 19,
+    .ultraLevel = 22,
+    .compress = zstdCompress,
+    .decompress = zstdDecompress,
+    .probe = zstdProbe,
+    .freeCache = zstdFreeCache
+};
+
+#define BUFFER_SIZE (4096 * 8)
+#define ZSTDMAGIC "\x28\xB5\x2F\xFD"
+
+static bool zstdProbe(const unsigned char* buffer, size_t bufferSize) {
+    return bufferSize >= 4 && memcmp(buffer, ZSTDMAGIC, 4) == 0;
+}
+
+#if WITH_LIBZSTD
+// The contexts are kept alive between files so that the tables and worker
+// threads can be reused.
+static _Thread_local ZSTD_CCtx* compressContext;
+static _Thread_local ZSTD_DCtx* decompressContext;
+
+static void* zstdAlloc(void* opaque, size_t size) {
+    return allocateMemory(opaque, size);
+}
+
+static void zstdFree(void* opaque, void* ptr) {
+    (void) opaque;
+    freeMemory(ptr);
+}
+
+static ZSTD_customMem getAllocator(void) {
+    ZSTD_customMem allocator = { zstdAlloc, zstdFree, getThreadAccount() };
+    return allocator;
+}
+
+static int getResult(size_t code) {
+    switch (ZSTD_getErrorCode(code)) {
+    case ZSTD_error_memory_allocation: return RESULT_OUT_OF_MEMORY;
+    case ZSTD_error_prefix_unknown:
+    case ZSTD_error_frameParameter_unsupported:
+    case ZSTD_error_frameParameter_windowTooLarge:
+    case ZSTD_error_corruption_detected:
+    case ZSTD_error_checksum_wrong:
+    case ZSTD_error_srcSize_wrong:
+        return RESULT_FORMAT_ERROR;
+    default: return RESULT_UNKNOWN_ERROR;
+    }
+}
+
+// Sets the parameters for compression and stores the number of threads used in
+// *threads.
+static size_t setParameters(ZSTD_CCtx* context, int level, int* threads) {
+    size_t result = ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel,
+            level);
+    if (ZSTD_isError(result)) return result;
+    result = ZSTD_CCtx_setParameter(context, ZSTD_c_checksumFlag, 1);
+    if (ZSTD_isError(result)) return result;
+
+    if (longWindowLog) {
+        result = ZSTD_CCtx_setParameter(context,
+                ZSTD_c_enableLongDistanceMatching, 1);
+        if (ZSTD_isError(result)) return result;
+        result = ZSTD_CCtx_setParameter(context, ZSTD_c_windowLog,
+                longWindowLog);
+        if (ZSTD_isError(result)) return result;
+    }
+
+    // Each worker needs about as much memory as a single-threaded stream.
+    ZSTD_compressionParameters parameters = ZSTD_getCParams(level, 0, 0);
+    if (longWindowLog) parameters.windowLog = longWindowLog;
+    size_t workers = getThreadCount(
+            ZSTD_estimateCStreamSize_usingCParams(parameters));
+    *threads = 1;
+    // This fails if libzstd was built without multithreading support. We
+    // then just compress using a single thread.
+    if (workers > 1 && !ZSTD_isError(ZSTD_CCtx_setParameter(context,
+            ZSTD_c_nbWorkers, (int) workers))) {
+        *threads = workers;
+    }
+    return 0;
+}
+#endif
+
+static void zstdFreeCache(void) {
+#if WITH_LIBZSTD
+    ZSTD_freeCCtx(compressContext);
+    compressContext = NULL;
+    ZSTD_freeDCtx(decompressContext);
+    decompressContext = NULL;
+#endif
+}
+
+static int zstdCompress(int input, int output, int level,
+        struct fileinfo* info) {
+#if WITH_LIBZSTD
+    if (!compressContext) {
+        compressContext = ZSTD_createCCtx_advanced(getAllocator());
+        if (!compressContext) return RESULT_OUT_OF_MEMORY;
+    } else {
+        ZSTD_CCtx_reset(compressContext, ZSTD_reset_session_and_parameters);
+    }
+    ZSTD_CCtx* context = compressContext;
+    size_t result = setParameters(context, level, &info->threads);
+    if (ZSTD_isError(result)) return getResult(result);
+
+    unsigned char inputBuffer[BUFFER_SIZE];
+    unsigned char outputBuffer[BUFFER_SIZE];
+    ZSTD_inBuffer in = { inputBuffer, 0, 0 };
+    ZSTD_outBuffer out = { outputBuffer, sizeof(outputBuffer), 0 };
+    off_t totalIn = 0;
+    off_t totalOut = 0;
+    ZSTD_EndDirective directive = ZSTD_e_continue;
+    struct flushcontrol flush = {0};
+
+    while (true) {
+        if (in.pos == in.size && directive == ZSTD_e_continue) {
+            info->uncompressedSize = totalIn;
+            info->compressedSize = totalOut;
+            if (!reportProgress(info)) return RESULT_ABORTED;
+
+            if (shouldFlush(input, &flush)) {
+                directive = ZSTD_e_flush;
+            } else {
+                ssize_t bytesRead = readInput(input, inputBuffer,
+                        sizeof(inputBuffer));
+                if (bytesRead < 0) return RESULT_READ_ERROR;
+                PROBE2(block, "zstd", bytesRead);
+                in.size = bytesRead;
+                in.pos = 0;
+                totalIn += bytesRead;
+                addFlushInput(&flush, bytesRead);
+                if (bytesRead == 0) directive = ZSTD_e_end;
+            }
+        }
+
+        result = ZSTD_compressStream2(context, &out, &in, directive);
+        if (ZSTD_isError(result)) return getResult(result);
+
+        if (out.pos == out.size ||
+                (directive != ZSTD_e_continue && result == 0)) {
+            if (writeAll(output, outputBuffer, out.pos) < 0) {
+                return RESULT_WRITE_ERROR;
+            }
+            totalOut += out.pos;
+            out.pos = 0;
+        }
+        if (directive == ZSTD_e_end && result == 0) break;
+        if (directive == ZSTD_e_flush && result == 0) {
+            directive = ZSTD_e_continue;
+        }
+    }
+
+    info->uncompressedSize = totalIn;
+    info->compressedSize = totalOut;
+    return RESULT_OK;
+#else
+    (void) input; (void) output; (void) level; (void) info;
+    return RESULT_UNIMPLEMENTED_FORMAT;
+#endif
+}
+
+static int zstdDecompress(int input, int output, struct fileinfo* info,
+        const unsigned char* buffer, size_t bufferSize) {
+#if WITH_LIBZSTD
+    reportHeader(info);
+    if (output == -2) {
+        output = openOutputFile(NULL, info->oinfo);
+        if (output < 0) return RESULT_OPEN_FAILURE;
+    }
+
+    if (!decompressContext) {
+        decompressContext = ZSTD_createDCtx_advanced(getAllocator());
+        if (!decompressContext) return RESULT_OUT_OF_MEMORY;
+    } else {
+        ZSTD_DCtx_reset(decompressContext, ZSTD_reset_session_and_parameters);
+    }
+    ZSTD_DCtx* context = decompressContext;
+    if (longWindowLog > 27) {
+        // Like the zstd utility we only accept windows larger than the default
+        // limit of 2^27 bytes when --long is given.
+        size_t result = ZSTD_DCtx_setParameter(context, ZSTD_d_windowLogMax,
+                longWindowLog);
+        if (ZSTD_isError(result)) return getResult(result);
+    }
+
+    unsigned char inputBuffer[BUFFER_SIZE];
+    unsigned char outputBuffer[BUFFER_SIZE];
+    memcpy(inputBuffer, buffer, bufferSize);
+    ZSTD_inBuffer in = { inputBuffer, bufferSize, 0 };
+    ZSTD_outBuffer out = { outputBuffer, sizeof(outputBuffer), 0 };
+    off_t totalIn = bufferSize;
+    off_t totalOut = 0;
+    // Nonzero while the current frame is incomplete.
+    size_t remaining = 1;
+
+    while (true) {
+        if (in.pos == in.size) {
+            info->compressedSize = totalIn;
+            info->uncompressedSize = totalOut;
+            if (!reportProgress(info)) return RESULT_ABORTED;
+
+            ssize_t bytesRead = readInput(input, inputBuffer,
+                    sizeof(inputBuffer));
+            if (bytesRead < 0) return RESULT_READ_ERROR;
+            PROBE2(block, "zstd", bytesRead);
+            if (bytesRead == 0) break;
+            in.size = bytesRead;
+            in.pos = 0;
+            totalIn += bytesRead;
+        }
+
+        // Concatenated frames are decompressed as a single stream.
+        remaining = ZSTD_decompressStream(context, &out, &in);
+        if (ZSTD_isError(remaining)) return getResult(remaining);
+
+        if (out.pos == out.size || remaining == 0) {
+            if (writeAll(output, outputBuffer, out.pos) < 0) {
+                return RESULT_WRITE_ERROR;
+            }
+            totalOut += out.pos;
+            out.pos = 0;
+        }
+    }
+
+    // Flush any output that is still buffered in the context.
+    while (remaining != 0) {
+        remaining = ZSTD_decompressStream(context, &out, &in);
+        if (ZSTD_isError(remaining)) return getResult(remaining);
+        if (out.pos == 0) return RESULT_FORMAT_ERROR;
+        if (writeAll(output, outputBuffer, out.pos) < 0) {
+            return RESULT_WRITE_ERROR;
+        }
+        totalOut += out.pos;
+        out.pos = 0;
+    }
+
+    info->compressedSize = totalIn;
+    info->uncompressedSize = totalOut;
+    info->crc = -1;
+    return RESULT_OK;
+#else
+    (void) input; (void) output; (void) info; (void) buffer; (void) bufferSize;
+    return RESULT_UNIMPLEMENTED_FORMAT;
+#endif
+}